@@ -28,8 +28,18 @@
 
 #include "flash.h"
 #include "82802ab.h"
+#include "jedec.h"
+#include "writeplan.h"
 #include "debug.h"
 
+#define BYTE_PROGRAM		0x40
+#define CLEAR_STATUS		0x50
+#define READ_ARRAY		0xFF
+
+#define STATUS_WSMS		(1 << 7)
+/* block erase, program, VPP and block lock errors */
+#define STATUS_ERRORS		0x3a
+
 // I need that Berkeley bit-map printer
 void print_82802ab_status(uint8_t status)
 {
@@ -47,26 +57,30 @@ int probe_82802ab(struct flashchip *flash)
 	volatile uint8_t *bios = flash->virtual_memory;
 	uint8_t id1, id2;
 
+	if (!probe_id_cached(probe_82802ab, bios, &id1, &id2)) {
 #if 0
-	*(volatile uint8_t *)(bios + 0x5555) = 0xAA;
-	*(volatile uint8_t *)(bios + 0x2AAA) = 0x55;
-	*(volatile uint8_t *)(bios + 0x5555) = 0x90;
+		chip_writeb(0xAA, bios + 0x5555);
+		chip_writeb(0x55, bios + 0x2AAA);
+		chip_writeb(0x90, bios + 0x5555);
 #endif
 
-	*bios = 0xff;
-	myusec_delay(10);
-	*bios = 0x90;
-	myusec_delay(10);
+		chip_writeb(0xff, bios);
+		myusec_delay(10);
+		chip_writeb(0x90, bios);
+		myusec_delay(10);
 
-	id1 = *(volatile uint8_t *)bios;
-	id2 = *(volatile uint8_t *)(bios + 0x01);
+		id1 = chip_readb(bios);
+		id2 = chip_readb(bios + 0x01);
 
-	/* Leave ID mode */
-	*(volatile uint8_t *)(bios + 0x5555) = 0xAA;
-	*(volatile uint8_t *)(bios + 0x2AAA) = 0x55;
-	*(volatile uint8_t *)(bios + 0x5555) = 0xF0;
+		/* Leave ID mode */
+		chip_writeb(0xAA, bios + 0x5555);
+		chip_writeb(0x55, bios + 0x2AAA);
+		chip_writeb(0xF0, bios + 0x5555);
 
-	myusec_delay(10);
+		myusec_delay(10);
+
+		probe_id_store(probe_82802ab, bios, id1, id2);
+	}
 
 	printf_debug("%s: id1 0x%x, id2 0x%x\n", __FUNCTION__, id1, id2);
 
@@ -78,59 +92,55 @@ int probe_82802ab(struct flashchip *flash)
 	return 1;
 }
 
-uint8_t wait_82802ab(volatile uint8_t *bios)
+/*
+ * Wait for the block erase at offset to finish, polling status bit 7
+ * within the chip's block erase time, then check the error bits and
+ * return to read array mode. print_status decodes a failed status.
+ */
+int wait_erase_82802ab(struct flashchip *flash, unsigned int offset,
+		       void (*print_status) (uint8_t status))
 {
-
+	volatile uint8_t *bios = flash->virtual_memory;
 	uint8_t status;
-	uint8_t id1, id2;
-
-	*bios = 0x70;
-	if ((*bios & 0x80) == 0) {	// it's busy
-		while ((*bios & 0x80) == 0) ;
+	int ret = 0;
+
+	if (data_polling_jedec(flash, bios + offset, STATUS_WSMS,
+			       FLASH_OP_BLOCK_ERASE)) {
+		ret = -1;
+	} else {
+		status = chip_readb(bios + offset);
+		if (status & STATUS_ERRORS) {
+			printf("block erase FAILED at 0x%08x, status ",
+			       offset);
+			print_status(status);
+			printf("\n");
+			ret = -1;
+		}
 	}
 
-	status = *bios;
-
-	// put another command to get out of status register mode
-
-	*bios = 0x90;
-	myusec_delay(10);
-
-	id1 = *(volatile uint8_t *)bios;
-	id2 = *(volatile uint8_t *)(bios + 0x01);
-
-	// this is needed to jam it out of "read id" mode
-	*(volatile uint8_t *)(bios + 0x5555) = 0xAA;
-	*(volatile uint8_t *)(bios + 0x2AAA) = 0x55;
-	*(volatile uint8_t *)(bios + 0x5555) = 0xF0;
-	return status;
-
+	chip_writeb(CLEAR_STATUS, bios);
+	chip_writeb(READ_ARRAY, bios);
+	return ret;
 }
-int erase_82802ab_block(struct flashchip *flash, int offset)
+
+int erase_82802ab_block(struct flashchip *flash, unsigned int offset,
+			unsigned int size)
 {
 	volatile uint8_t *bios = flash->virtual_memory + offset;
 	volatile uint8_t *wrprotect = flash->virtual_registers + offset + 2;
-	uint8_t status;
 
 	// clear status register
-	*bios = 0x50;
-	//printf("Erase at %p\n", bios);
+	chip_writeb(CLEAR_STATUS, bios);
 	// clear write protect
-	//printf("write protect is at %p\n", (wrprotect));
-	//printf("write protect is 0x%x\n", *(wrprotect));
-	*(wrprotect) = 0;
-	//printf("write protect is 0x%x\n", *(wrprotect));
+	chip_writeb(0, wrprotect);
 
 	// now start it
-	*(volatile uint8_t *)(bios) = 0x20;
-	*(volatile uint8_t *)(bios) = 0xd0;
-	myusec_delay(10);
-	// now let's see what the register is
-	status = wait_82802ab(flash->virtual_memory);
-	//print_82802ab_status(status);
-	printf("DONE BLOCK 0x%x\n", offset);
-	return (0);
+	chip_writeb(0x20, bios);
+	chip_writeb(0xd0, bios);
+
+	return wait_erase_82802ab(flash, offset, print_82802ab_status);
 }
+
 int erase_82802ab(struct flashchip *flash)
 {
 	int i;
@@ -139,45 +149,81 @@ int erase_82802ab(struct flashchip *flash)
 	printf("total_size is %d; flash->page_size is %d\n",
 	       total_size, flash->page_size);
 	for (i = 0; i < total_size; i += flash->page_size)
-		erase_82802ab_block(flash, i);
+		if (erase_82802ab_block(flash, i, flash->page_size))
+			return -1;
 	printf("DONE ERASE\n");
 	return (0);
 }
 
-void write_page_82802ab(volatile uint8_t *bios, uint8_t *src,
-			volatile uint8_t *dst, int page_size)
+/*
+ * Program a block without leaving status mode between bytes. After a
+ * byte program the chip answers any read with its status, so the next
+ * command can follow as soon as bit 7 reports the write state machine
+ * ready. The error bits are sticky and are only checked once the whole
+ * block is done. The array cannot be read in status mode, so the bytes
+ * that already match are found in old, the write engine's copy of the
+ * block. print_status decodes the status byte if the block fails.
+ */
+int write_block_82802ab(struct flashchip *flash, uint8_t *src,
+			const uint8_t *old, unsigned int offset,
+			unsigned int size, void (*print_status) (uint8_t status))
 {
-	int i;
+	volatile uint8_t *bios = flash->virtual_memory;
+	volatile uint8_t *dst = bios + offset;
+	unsigned int i;
+	int programmed = 0, ret = 0;
+	uint8_t status;
+
+	chip_writeb(CLEAR_STATUS, bios);
+	for (i = 0; i < size; i++) {
+		/* If the data is already there, don't program it */
+		if (old[i] == src[i])
+			continue;
+		chip_writeb(BYTE_PROGRAM, dst + i);
+		chip_writeb(src[i], dst + i);
+		programmed = 1;
+
+		/* a status read with bit 7 set is what data polling for
+		 * STATUS_WSMS waits for */
+		if (data_polling_jedec(flash, bios, STATUS_WSMS,
+				       FLASH_OP_PROGRAM)) {
+			ret = -1;
+			goto out;
+		}
+	}
 
-	for (i = 0; i < page_size; i++) {
-		/* transfer data from source to destination */
-		*dst = 0x40;
-		*dst++ = *src++;
-		wait_82802ab(bios);
+	if (programmed) {
+		status = chip_readb(bios);
+		if (status & STATUS_ERRORS) {
+			printf("write FAILED in block at 0x%08x, status ",
+			       offset);
+			print_status(status);
+			printf("\n");
+			ret = -1;
+		}
 	}
 
+out:
+	chip_writeb(CLEAR_STATUS, bios);
+	chip_writeb(READ_ARRAY, bios);
+	return ret;
+}
+
+static int program_block_82802ab(struct flashchip *flash, uint8_t *src,
+				 const uint8_t *old, unsigned int offset,
+				 unsigned int size)
+{
+	return write_block_82802ab(flash, src, old, offset, size,
+				   print_82802ab_status);
 }
 
 int write_82802ab(struct flashchip *flash, uint8_t *buf)
 {
-	int i;
-	int total_size = flash->total_size * 1024;
-	int page_size = flash->page_size;
-	volatile uint8_t *bios = flash->virtual_memory;
+	int ret;
 
-	erase_82802ab(flash);
-	if (*bios != 0xff) {
-		printf("ERASE FAILED\n");
-		return -1;
-	}
-	printf("Programming Page: ");
-	for (i = 0; i < total_size / page_size; i++) {
-		printf("%04d at address: 0x%08x", i, i * page_size);
-		write_page_82802ab(bios, buf + i * page_size,
-				   bios + i * page_size, page_size);
-		printf("\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
-	}
-	printf("\n");
-	protect_82802ab(bios);
-	return (0);
+	ret = write_flash_blocks(flash, buf, flash->page_size,
+				 erase_82802ab_block, program_block_82802ab);
+	protect_82802ab(flash->virtual_memory);
+
+	return ret;
 }
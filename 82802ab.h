@@ -4,44 +4,18 @@
 extern int probe_82802ab(struct flashchip *flash);
 extern int erase_82802ab(struct flashchip *flash);
 extern int write_82802ab(struct flashchip *flash, uint8_t *buf);
-
-extern __inline__ void toggle_ready_82802ab(volatile uint8_t *dst)
-{
-	unsigned int i = 0;
-	uint8_t tmp1, tmp2;
-
-	tmp1 = *dst & 0x40;
-
-	while (i++ < 0xFFFFFF) {
-		tmp2 = *dst & 0x40;
-		if (tmp1 == tmp2) {
-			break;
-		}
-		tmp1 = tmp2;
-	}
-}
-
-extern __inline__ void data_polling_82802ab(volatile uint8_t *dst,
-					    uint8_t data)
-{
-	unsigned int i = 0;
-	uint8_t tmp;
-
-	data &= 0x80;
-
-	while (i++ < 0xFFFFFF) {
-		tmp = *dst & 0x80;
-		if (tmp == data) {
-			break;
-		}
-	}
-}
-
-extern __inline__ void protect_82802ab(volatile uint8_t *bios)
+extern int write_block_82802ab(struct flashchip *flash, uint8_t *src,
+			       const uint8_t *old, unsigned int offset,
+			       unsigned int size,
+			       void (*print_status) (uint8_t status));
+extern int wait_erase_82802ab(struct flashchip *flash, unsigned int offset,
+			      void (*print_status) (uint8_t status));
+
+static __inline__ void protect_82802ab(volatile uint8_t *bios)
 {
-	*(volatile uint8_t *)(bios + 0x5555) = 0xAA;
-	*(volatile uint8_t *)(bios + 0x2AAA) = 0x55;
-	*(volatile uint8_t *)(bios + 0x5555) = 0xA0;
+	chip_writeb(0xAA, bios + 0x5555);
+	chip_writeb(0x55, bios + 0x2AAA);
+	chip_writeb(0xA0, bios + 0x5555);
 
 	myusec_delay(200);
 }
@@ -24,54 +24,129 @@
 
 #include <stdio.h>
 #include <stdint.h>
-#include <windows.h>
 #include "flash.h"
 #include "jedec.h"
+#include "writeplan.h"
 #include "debug.h"
-//#include "udelay.h"
 
-static __inline__ int erase_sector_29f040b(volatile uint8_t *bios,
-					   unsigned long address)
+/*
+ * Embedded algorithm completion: DQ7 reads the complement of the data
+ * being written until the operation is done, and DQ5 goes high when the
+ * chip itself gave up. Sleep through half the typical time from the
+ * chip's timing table, then poll with a growing delay so a sector erase
+ * does not hammer the bus, and give up after the data sheet maximum.
+ */
+static int wait_29f040b(struct flashchip *flash, volatile uint8_t *dst,
+			uint8_t data, enum flash_op op)
 {
-	*(bios + 0x555) = 0xAA;
-	*(bios + 0x2AA) = 0x55;
-	*(bios + 0x555) = 0x80;
-	*(bios + 0x555) = 0xAA;
-	*(bios + 0x2AA) = 0x55;
-	*(bios + address) = 0x30;
+	unsigned long typ, timeout, elapsed, poll = 1, max_poll;
+	uint8_t status;
+
+	flash_op_timing(flash, op, &typ, &timeout);
+
+	elapsed = typ / 2;
+	if (elapsed)
+		myusec_delay(elapsed);
+
+	max_poll = typ / 8;
+	if (max_poll < 1)
+		max_poll = 1;
+	if (max_poll > 10000)
+		max_poll = 10000;
+
+	data &= 0x80;
+
+	while (1) {
+		status = chip_readb(dst);
+		if ((status & 0x80) == data)
+			return 0;
+
+		if (status & 0x20) {
+			/* DQ7 may change at the same time as DQ5 */
+			if ((chip_readb(dst) & 0x80) == data)
+				return 0;
+			break;
+		}
+
+		if (elapsed >= timeout)
+			break;
+
+		myusec_delay(poll);
+		elapsed += poll;
+		if (poll < max_poll)
+			poll <<= 1;
+		if (poll > max_poll)
+			poll = max_poll;
+	}
 
-	myusec_delay(2000000);
+	/* Return to read array mode */
+	chip_writeb(0xF0, dst);
+	return -1;
+}
+
+static __inline__ int erase_sector_29f040b(struct flashchip *flash,
+					   unsigned long address)
+{
+	volatile uint8_t *bios = flash->virtual_memory;
 
-	/* wait for Toggle bit ready         */
-	toggle_ready_jedec(bios + address);
+	chip_writeb(0xAA, bios + 0x555);
+	chip_writeb(0x55, bios + 0x2AA);
+	chip_writeb(0x80, bios + 0x555);
+	chip_writeb(0xAA, bios + 0x555);
+	chip_writeb(0x55, bios + 0x2AA);
+	chip_writeb(0x30, bios + address);
+
+	/* erased data reads 0xFF, so DQ7 goes high once we are done */
+	if (wait_29f040b(flash, bios + address, 0xFF,
+			 FLASH_OP_SECTOR_ERASE)) {
+		printf("sector erase FAILED at address=0x%08lx\n", address);
+		return -1;
+	}
 
 	return (0);
 }
 
-static __inline__ int write_sector_29f040b(volatile uint8_t *bios,
+static __inline__ int write_sector_29f040b(struct flashchip *flash,
 					   uint8_t *src,
+					   const uint8_t *old,
 					   volatile uint8_t *dst,
 					   unsigned int page_size)
 {
-	int i;
-
-	for (i = 0; i < page_size; i++) {
-		if ((i & 0xfff) == 0xfff)
-			printf("0x%08lx", (unsigned long)dst -
-			       (unsigned long)bios);
-
-		*(bios + 0x555) = 0xAA;
-		*(bios + 0x2AA) = 0x55;
-		*(bios + 0x555) = 0xA0;
-		*dst++ = *src++;
+	volatile uint8_t *bios = flash->virtual_memory;
+	int i, bypass = flash->feature_bits & FEATURE_UNLOCK_BYPASS;
 
-		/* wait for Toggle bit ready */
-		toggle_ready_jedec(bios);
+	if (bypass)
+		enter_unlock_bypass(bios);
 
-		if ((i & 0xfff) == 0xfff)
-			printf("\b\b\b\b\b\b\b\b\b\b");
+	for (i = 0; i < page_size; i++) {
+		/* Skip bytes that already match */
+		if (old[i] == *src) {
+			dst++, src++;
+			continue;
+		}
+
+		if (!bypass) {
+			chip_writeb(0xAA, bios + 0x555);
+			chip_writeb(0x55, bios + 0x2AA);
+		}
+		chip_writeb(0xA0, bios + 0x555);
+		chip_writeb(*src, dst);
+
+		if (wait_29f040b(flash, dst, *src, FLASH_OP_PROGRAM)) {
+			printf("byte program FAILED at address=0x%08lx\n",
+			       (unsigned long)(dst - bios));
+			if (bypass) {
+				exit_unlock_bypass(bios);
+				chip_writeb(0xF0, bios);
+			}
+			return -1;
+		}
+		dst++, src++;
 	}
 
+	if (bypass)
+		exit_unlock_bypass(bios);
+
 	return (0);
 }
 
@@ -80,16 +155,20 @@ int probe_29f040b(struct flashchip *flash)
 	volatile uint8_t *bios = flash->virtual_memory;
 	uint8_t id1, id2;
 
-	*(bios + 0x555) = 0xAA;
-	*(bios + 0x2AA) = 0x55;
-	*(bios + 0x555) = 0x90;
+	if (!probe_id_cached(probe_29f040b, bios, &id1, &id2)) {
+		chip_writeb(0xAA, bios + 0x555);
+		chip_writeb(0x55, bios + 0x2AA);
+		chip_writeb(0x90, bios + 0x555);
 
-	id1 = *bios;
-	id2 = *(bios + 0x01);
+		id1 = chip_readb(bios);
+		id2 = chip_readb(bios + 0x01);
 
-	*bios = 0xF0;
+		chip_writeb(0xF0, bios);
 
-	myusec_delay(10);
+		myusec_delay(10);
+
+		probe_id_store(probe_29f040b, bios, id1, id2);
+	}
 
 	printf_debug("%s: id1 0x%x, id2 0x%x\n", __FUNCTION__, id1, id2);
 	if (id1 == flash->manufacture_id && id2 == flash->model_id)
@@ -102,38 +181,46 @@ int erase_29f040b(struct flashchip *flash)
 {
 	volatile uint8_t *bios = flash->virtual_memory;
 
-	*(bios + 0x555) = 0xAA;
-	*(bios + 0x2AA) = 0x55;
-	*(bios + 0x555) = 0x80;
-	*(bios + 0x555) = 0xAA;
-	*(bios + 0x2AA) = 0x55;
-	*(bios + 0x555) = 0x10;
+	chip_writeb(0xAA, bios + 0x555);
+	chip_writeb(0x55, bios + 0x2AA);
+	chip_writeb(0x80, bios + 0x555);
+	chip_writeb(0xAA, bios + 0x555);
+	chip_writeb(0x55, bios + 0x2AA);
+	chip_writeb(0x10, bios + 0x555);
 
-	myusec_delay(10);
-	toggle_ready_jedec(bios);
+	if (wait_29f040b(flash, bios, 0xFF, FLASH_OP_CHIP_ERASE)) {
+		printf("chip erase FAILED\n");
+		return -1;
+	}
 
 	return (0);
 }
 
-int write_29f040b(struct flashchip *flash, uint8_t *buf)
+static int erase_block_29f040b(struct flashchip *flash, unsigned int offset,
+			       unsigned int size)
+{
+	return erase_sector_29f040b(flash, offset);
+}
+
+static int program_block_29f040b(struct flashchip *flash, uint8_t *src,
+				 const uint8_t *old, unsigned int offset,
+				 unsigned int size)
 {
-	int i;
-	int total_size = flash->total_size * 1024;
-	int page_size = flash->page_size;
 	volatile uint8_t *bios = flash->virtual_memory;
 
-	printf("Programming page ");
-	for (i = 0; i < total_size / page_size; i++) {
-		/* erase the page before programming */
-		erase_sector_29f040b(bios, i * page_size);
+	return write_sector_29f040b(flash, src, old, bios + offset, size);
+}
 
-		/* write to the sector */
-		printf("%04d at address: ", i);
-		write_sector_29f040b(bios, buf + i * page_size,
-				     bios + i * page_size, page_size);
-		printf("\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
-	}
-	printf("\n");
+/* sector erase, or a chip erase when most sectors change anyway */
+static const struct erase_method erase_methods_29f040b[] = {
+	{0x30, erase_block_29f040b},
+	{0, NULL},
+};
 
-	return (0);
+int write_29f040b(struct flashchip *flash, uint8_t *buf)
+{
+	/* sectors that already match the image are neither erased
+	 * nor programmed */
+	return write_flash_planned(flash, buf, erase_methods_29f040b, 2,
+				   program_block_29f040b);
 }
@@ -0,0 +1,290 @@
+/*
+ * bench.c: driver throughput benchmark on the simulated chip
+ *
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *
+ * Runs read, erase, program and verify for the first chip of each driver
+ * family against the simulator (sim.c), using the chip's timing table
+ * for the program and erase latencies, and prints one JSON document:
+ *
+ *   bytes_per_sec    throughput on the simulated bus
+ *   cycles_per_byte  bus reads + writes per byte handled
+ *   polls            reads that returned status instead of data
+ *   sim_us, wall_us  simulated time and host time spent
+ *
+ * The image is pseudo-random with a fixed seed, so runs are comparable.
+ * Driver chatter goes to the null device; only the JSON reaches stdout.
+ *
+ * usage: flashbench [-O simoptions] [driver...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+
+#include "flash.h"
+#include "jedec.h"
+#include "am29f040b.h"
+#include "mx29f002.h"
+#include "sst39sf020.h"
+#include "sst49lf040.h"
+#include "sst49lfxxxc.h"
+#include "sst_fwhub.h"
+#include "82802ab.h"
+#include "pm49fl004.h"
+#include "udelay.h"
+#include "verify.h"
+#include "sim.h"
+
+#ifdef __MINGW32_VERSION
+#define NULL_DEV	"NUL"
+#else
+#define NULL_DEV	"/dev/null"
+#endif
+
+static const struct {
+	const char *name;
+	int (*write) (struct flashchip *flash, uint8_t *buf);
+} families[] = {
+	{"write_jedec",		write_jedec},
+	{"write_39sf020",	write_39sf020},
+	{"write_49lf040",	write_49lf040},
+	{"write_49lfxxxc",	write_49lfxxxc},
+	{"write_sst_fwhub",	write_sst_fwhub},
+	{"write_82802ab",	write_82802ab},
+	{"write_29f040b",	write_29f040b},
+	{"write_29f002",	write_29f002},
+	{"write_49fl004",	write_49fl004},
+	{NULL,			NULL}
+};
+
+enum {
+	PHASE_READ,
+	PHASE_ERASE,
+	PHASE_PROGRAM,
+	PHASE_VERIFY,
+	NUM_PHASES
+};
+
+static const char *phase_names[NUM_PHASES] = {
+	"read", "erase", "program", "verify"
+};
+
+struct phase_result {
+	int ok;
+	uint64_t sim_ns, wall_us;
+	struct sim_counters c;
+};
+
+static void fill_image(uint8_t *buf, unsigned long size)
+{
+	uint32_t seed = 0x12345678;
+	unsigned long i;
+
+	for (i = 0; i < size; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+}
+
+static int run_phase(struct flashchip *flash, int phase, uint8_t *image,
+		     uint8_t *buf, struct phase_result *r)
+{
+	unsigned long size = flash->total_size * 1024;
+	struct sim_counters start;
+	struct flash_range *ranges;
+	uint64_t sim_start, wall_start;
+	int ret = 0;
+
+	sim_get_counters(&start);
+	sim_start = sim_clock_ns();
+	wall_start = myusec_now();
+
+	switch (phase) {
+	case PHASE_READ:
+		ret = read_flash_range(flash, buf, 0, size);
+		break;
+	case PHASE_ERASE:
+		ret = flash->erase(flash);
+		break;
+	case PHASE_PROGRAM:
+		ret = flash->write(flash, image);
+		break;
+	case PHASE_VERIFY:
+		ret = compare_flash(flash, image, &ranges);
+		if (ret > 0)
+			free(ranges);
+		break;
+	}
+
+	r->wall_us = myusec_now() - wall_start;
+	r->sim_ns = sim_clock_ns() - sim_start;
+	sim_get_counters(&r->c);
+	r->c.reads -= start.reads;
+	r->c.writes -= start.writes;
+	r->c.polls -= start.polls;
+	r->ok = (ret == 0);
+
+	/* an erase only counts if it left the chip blank */
+	if (phase == PHASE_ERASE && r->ok)
+		r->ok = (blank_check(flash, 0, size, size, NULL) == 0);
+
+	return r->ok ? 0 : -1;
+}
+
+static int bench_family(FILE *json, int family, const char *options,
+			int *first)
+{
+	struct phase_result results[NUM_PHASES];
+	struct flashchip *flash;
+	unsigned long size;
+	uint8_t *image, *buf;
+	char spec[256];
+	int i, ret = 0;
+
+	for (flash = flashchips; flash->name != NULL; flash++)
+		if (flash->write == families[family].write)
+			break;
+	if (flash->name == NULL) {
+		fprintf(stderr, "No chip uses %s\n", families[family].name);
+		return -1;
+	}
+
+	snprintf(spec, sizeof(spec), "%s%s%s", flash->name,
+		 options ? "," : "", options ? options : "");
+	if (sim_init(spec))
+		return -1;
+
+	size = flash->total_size * 1024;
+	image = (uint8_t *) malloc(size);
+	buf = (uint8_t *) malloc(size);
+	if (image == NULL || buf == NULL) {
+		fprintf(stderr, "Error: Out of memory for the image\n");
+		exit(1);
+	}
+	fill_image(image, size);
+
+	flash->virtual_memory = sim_map(0x100000000ULL - size, size);
+	if (flash->virtual_memory == NULL || flash->probe(flash) != 1) {
+		fprintf(stderr, "%s: simulated %s did not probe\n",
+			families[family].name, flash->name);
+		ret = -1;
+		goto out;
+	}
+
+	for (i = 0; i < NUM_PHASES; i++)
+		if (run_phase(flash, i, image, buf, &results[i]))
+			ret = -1;
+
+	fprintf(json, "%s\n    {\"driver\": \"%s\", \"chip\": \"%s\", "
+		"\"bytes\": %lu,\n", *first ? "" : ",", families[family].name,
+		flash->name, size);
+	*first = 0;
+	for (i = 0; i < NUM_PHASES; i++) {
+		struct phase_result *r = &results[i];
+		double sim_s = r->sim_ns / 1e9;
+
+		fprintf(json, "     \"%s\": {\"ok\": %s, \"bytes_per_sec\": %.0f, "
+			"\"cycles_per_byte\": %.3f, \"bus_reads\": %lu, "
+			"\"bus_writes\": %lu, \"polls\": %lu, \"sim_us\": %.0f, "
+			"\"wall_us\": %.0f}%s\n", phase_names[i],
+			r->ok ? "true" : "false",
+			sim_s > 0 ? size / sim_s : 0.0,
+			(double)(r->c.reads + r->c.writes) / size,
+			r->c.reads, r->c.writes, r->c.polls, r->sim_ns / 1e3,
+			(double)r->wall_us, i == NUM_PHASES - 1 ? "}" : ",");
+	}
+
+out:
+	sim_unmap(flash->virtual_memory);
+	if (flash->virtual_registers != NULL)
+		sim_unmap(flash->virtual_registers);
+	flash->virtual_memory = NULL;
+	flash->virtual_registers = NULL;
+	sim_exit();
+	free(image);
+	free(buf);
+
+	return ret;
+}
+
+static void usage(const char *name)
+{
+	int i;
+
+	printf("usage: %s [-O simoptions] [driver...]\n", name);
+	printf("   -O <options>: simulator options, e.g. access=250,program=10\n"
+	       "   drivers:");
+	for (i = 0; families[i].name != NULL; i++)
+		printf(" %s", families[i].name);
+	printf("\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	char *options = NULL;
+	uint64_t start;
+	FILE *json;
+	int i, j, opt, first = 1, ret = 0;
+
+	while ((opt = getopt(argc, argv, "O:h")) != EOF) {
+		switch (opt) {
+		case 'O':
+			options = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			break;
+		}
+	}
+	for (j = optind; j < argc; j++) {
+		for (i = 0; families[i].name != NULL; i++)
+			if (!strcmp(argv[j], families[i].name))
+				break;
+		if (families[i].name == NULL)
+			usage(argv[0]);
+	}
+
+	/* keep stdout for the JSON, send the drivers' progress output away */
+	json = fdopen(dup(fileno(stdout)), "w");
+	if (json == NULL || freopen(NULL_DEV, "w", stdout) == NULL) {
+		perror("Can't redirect stdout");
+		exit(1);
+	}
+
+	start = myusec_now();
+	fprintf(json, "{\"families\": [");
+	for (i = 0; families[i].name != NULL; i++) {
+		if (optind < argc) {
+			for (j = optind; j < argc; j++)
+				if (!strcmp(argv[j], families[i].name))
+					break;
+			if (j == argc)
+				continue;
+		}
+		if (bench_family(json, i, options, &first))
+			ret = 1;
+	}
+	fprintf(json, "\n  ],\n  \"wall_us\": %.0f\n}\n",
+		(double)(myusec_now() - start));
+	fclose(json);
+
+	return ret;
+}
@@ -5,6 +5,8 @@
 #include "interfaces.h" // Must be included after winioctl.h
 #include "direct_io.h"
 #include "error_msg.h"
+#include "stats.h"
+#include "trace.h"
 
 #define DRIVER_NAME       "winflashrom"
 
@@ -320,11 +322,16 @@ Return Value:
 
 void cleanup_driver()
 {
+	/* nothing to undo if the driver was never loaded (--simulate) */
+	if (h_device == INVALID_HANDLE_VALUE)
+		return;
+
     //
     // Close the access to the exported device interface in user-mode
     //
 	if(h_device != INVALID_HANDLE_VALUE) {
 		CloseHandle(h_device); 
+		h_device = INVALID_HANDLE_VALUE;
 	}
 
     //
@@ -352,6 +359,8 @@ unsigned char inb(unsigned short port)
     ioBuf.port8 = port; // port address to read from
     
 
+    STAT_INC(port_reads);
+
     if( INVALID_HANDLE_VALUE == h_device) {
 	printf("(inl) Error: the driver handle is invalid!\n");
 	return -1;
@@ -375,6 +384,8 @@ unsigned char inb(unsigned short port)
 	    bytes_returned);
 #endif //VEBOSE_DEBUG_MESSAGE
 
+    if (trace_active)
+	trace_port(TRACE_PORT_IN, port, ioBuf.value8, 1);
     return ioBuf.value8;
 }
 
@@ -387,6 +398,10 @@ void outb(unsigned char value, unsigned short port)
     ioBuf.port8 = port; // port address to write to
     ioBuf.value8 = value; 
 
+    STAT_INC(port_writes);
+    if (trace_active)
+	trace_port(TRACE_PORT_OUT, port, value, 1);
+
     if( INVALID_HANDLE_VALUE == h_device) {
 	printf("(outw) Error: the driver handle is invalid!\n");
 	return;
@@ -419,6 +434,8 @@ unsigned short inw(unsigned short port)
     ioBuf.port16 = port; // port address to read from
     
 
+    STAT_INC(port_reads);
+
     if( INVALID_HANDLE_VALUE == h_device) {
 	printf("(inl) Error: the driver handle is invalid!\n");
 	return -1;
@@ -442,6 +459,8 @@ unsigned short inw(unsigned short port)
 	    bytes_returned);
 #endif //VEBOSE_DEBUG_MESSAGE
 
+    if (trace_active)
+	trace_port(TRACE_PORT_IN, port, ioBuf.value16, 2);
     return ioBuf.value16;
 }
 
@@ -454,6 +473,10 @@ void outw(unsigned short value, unsigned short port)
     ioBuf.port16 = port; // port address to write to
     ioBuf.value16 = value; 
 
+    STAT_INC(port_writes);
+    if (trace_active)
+	trace_port(TRACE_PORT_OUT, port, value, 2);
+
     if( INVALID_HANDLE_VALUE == h_device) {
 	printf("(outw) Error: the driver handle is invalid!\n");
 	return;
@@ -486,6 +509,8 @@ unsigned long inl(unsigned short port)
     ioBuf.port32 = port; // port address to read from
     
 
+    STAT_INC(port_reads);
+
     if( INVALID_HANDLE_VALUE == h_device) {
 	printf("(inl) Error: the driver handle is invalid!\n");
 	return -1;
@@ -509,6 +534,8 @@ unsigned long inl(unsigned short port)
 	    bytes_returned);
 	 #endif //VEBOSE_DEBUG_MESSAGE
 
+    if (trace_active)
+	trace_port(TRACE_PORT_IN, port, ioBuf.value32, 4);
     return ioBuf.value32;
 }
 
@@ -521,6 +548,10 @@ void outl(unsigned long value, unsigned short port)
     ioBuf.port32 = port; // port address to write to
     ioBuf.value32 = value; 
 
+    STAT_INC(port_writes);
+    if (trace_active)
+	trace_port(TRACE_PORT_OUT, port, value, 4);
+
     if( INVALID_HANDLE_VALUE == h_device) {
 	printf("(outl) Error: the driver handle is invalid!\n");
 	return;
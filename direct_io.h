@@ -17,6 +17,8 @@ void hal_pci_write_offset( unsigned long  bus, unsigned long  device,
 			   unsigned long  function, unsigned long  offset, 
 			   unsigned long value, unsigned char length );
 
+/* unless <sys/io.h> already declared glibc's port I/O */
+#ifndef _SYS_IO_H
 void outb(unsigned char value, unsigned short port);
 void outw(unsigned short value, unsigned short port);
 void outl(unsigned long value, unsigned short port);
@@ -24,5 +26,6 @@ void outl(unsigned long value, unsigned short port);
 unsigned char inb(unsigned short port);
 unsigned short inw(unsigned short port);
 unsigned long inl(unsigned short port);
+#endif
 
 #endif //__DIRECT_IO_H__
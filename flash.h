@@ -30,6 +30,45 @@
 
 #include <unistd.h>
 #include <stdint.h>
+#include <string.h>
+
+#include "stats.h"
+#include "trace.h"
+
+/* Typical and maximum times from the data sheet, in microseconds.
+ * A maximum of 0 means unknown; the polling code then uses a
+ * conservative default instead.
+ */
+struct flashchip_timing {
+	unsigned long program_typ, program_max;		/* tBP (or page) */
+	unsigned long sector_erase_typ, sector_erase_max;	/* tSE */
+	unsigned long block_erase_typ, block_erase_max;	/* tBE */
+	unsigned long chip_erase_typ, chip_erase_max;	/* tSCE */
+};
+
+enum flash_op {
+	FLASH_OP_PROGRAM,
+	FLASH_OP_SECTOR_ERASE,
+	FLASH_OP_BLOCK_ERASE,
+	FLASH_OP_CHIP_ERASE,
+};
+
+/* A run of count erase blocks of block_size bytes each. A chip lists
+ * the blocks of every erase command it has, each command's regions
+ * covering the whole chip from the bottom up, so boot block parts can
+ * be described next to their uniform sector erase. The table ends with
+ * a zero block_size; chips without one erase in page_size blocks.
+ */
+struct erase_region {
+	unsigned int block_size;
+	unsigned int count;
+	uint8_t opcode;		/* command byte that selects this erase */
+	enum flash_op op;	/* timing table entry for its erase time */
+};
+
+/* feature_bits: optional commands a chip supports */
+#define FEATURE_UNLOCK_BYPASS	(1 << 0)	/* AMD/ST 20 ... 90 00 */
+#define FEATURE_PAGE_WRITE	(1 << 1)	/* a page write erases the page */
 
 struct flashchip {
 	char *name;
@@ -42,6 +81,9 @@ struct flashchip {
 	int (*probe) (struct flashchip *flash);
 	int (*erase) (struct flashchip *flash);
 	int (*write) (struct flashchip *flash, uint8_t *buf);
+	const struct flashchip_timing *timing;
+	const struct erase_region *erase_regions;
+	unsigned int feature_bits;
 	int (*read) (struct flashchip *flash, uint8_t *buf);
 
 	/* some flash devices have an additional
@@ -49,6 +91,11 @@ struct flashchip {
 	 */
 	volatile uint8_t *virtual_memory;
 	volatile uint8_t *virtual_registers;
+
+	/* one bit per page_size page, set if the page may be changed;
+	 * NULL means the whole chip (see write_mask_exclude())
+	 */
+	uint8_t *write_mask;
 };
 
 extern struct flashchip flashchips[];
@@ -146,7 +193,7 @@ void myusec_delay(int time);
 void myusec_calibrate_delay();
 
 /* pci handling for board/chipset_enable */
-struct pci_access *pacc;	/* For board and chipset_enable */
+extern struct pci_access *pacc;	/* For board and chipset_enable */
 struct pci_dev *pci_dev_find(uint16_t vendor, uint16_t device);
 struct pci_dev *pci_card_find(uint16_t vendor, uint16_t device,
 			      uint16_t card_vendor, uint16_t card_device);
@@ -165,5 +212,58 @@ int chipset_flash_enable(void);	/* chipset_enable.c */
 extern int fd_mem;
 
 int map_flash_registers(struct flashchip *flash); /* flashrom.c */
+int probe_id_cached(int (*method) (struct flashchip *flash),
+		    volatile uint8_t *bios, uint8_t *id1, uint8_t *id2);
+void probe_id_store(int (*method) (struct flashchip *flash),
+		    volatile uint8_t *bios, uint8_t id1, uint8_t id2);
+
+/* chip access: the bus, or the simulated chip with --simulate */
+
+extern int sim_active;
+uint8_t sim_readb(const volatile uint8_t *addr);	/* sim.c */
+void sim_writeb(uint8_t val, volatile uint8_t *addr);	/* sim.c */
+
+static __inline__ uint8_t chip_readb(const volatile uint8_t *addr)
+{
+	uint8_t val;
+
+	STAT_INC(chip_reads);
+	if (sim_active)
+		val = sim_readb(addr);
+	else
+		val = *addr;
+	if (trace_active)
+		trace_chip(TRACE_READ, addr, val);
+	return val;
+}
+
+static __inline__ void chip_writeb(uint8_t val, volatile uint8_t *addr)
+{
+	STAT_INC(chip_writes);
+	if (trace_active)
+		trace_chip(TRACE_WRITE, addr, val);
+	if (sim_active) {
+		sim_writeb(val, addr);
+		return;
+	}
+	*addr = val;
+}
+
+/* Bulk read; one memcpy on real hardware */
+static __inline__ void chip_readn(uint8_t *buf, const volatile uint8_t *addr,
+				  size_t len)
+{
+	size_t i;
+
+	STAT_ADD(chip_reads, len);
+	if (trace_active)
+		trace_chip(TRACE_READN, addr, len);
+	if (!sim_active) {
+		memcpy(buf, (const void *)addr, len);
+		return;
+	}
+	for (i = 0; i < len; i++)
+		buf[i] = sim_readb(addr + i);
+}
 
 #endif				/* !__FLASH_H__ */
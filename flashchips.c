@@ -40,65 +40,164 @@
 #include "sharplhf00l04.h"
 #include "sst_fwhub.h"
 
+/* Program and erase times in microseconds, typical and maximum, as
+ * given in the data sheets: program, sector, block and chip erase.
+ * Chips without an entry get the conservative defaults from jedec.c.
+ */
+static const struct flashchip_timing timing_29f040b = {
+	7, 300,	1000000, 8000000,	0, 0,	8000000, 64000000
+};
+
+static const struct flashchip_timing timing_29f016d = {
+	7, 300,	1000000, 8000000,	0, 0,	25000000, 256000000
+};
+
+/* Page write parts: the program time is the page write cycle tWC */
+static const struct flashchip_timing timing_page_write = {
+	0, 10000,	0, 0,		0, 0,	0, 0
+};
+
+static const struct flashchip_timing timing_sst39sf = {
+	14, 20,	18000, 25000,	0, 0,	70000, 100000
+};
+
+static const struct flashchip_timing timing_sst49lf = {
+	14, 20,	18000, 25000,	18000, 25000,	70000, 100000
+};
+
+/* Erase blocks for each erase command, bottom up; a count of 0 fills
+ * whatever the other regions of the command leave of the chip.
+ */
+static const struct erase_region geometry_29f040b[] = {
+	{64 * 1024, 0, 0x30, FLASH_OP_SECTOR_ERASE},
+	{0}
+};
+
+static const struct erase_region geometry_sector[] = {
+	{4 * 1024, 0, 0x30, FLASH_OP_SECTOR_ERASE},
+	{0}
+};
+
+/* LPC/FWH parts with 4K sectors inside 16K or 64K blocks */
+static const struct erase_region geometry_sector_block16k[] = {
+	{4 * 1024, 0, 0x30, FLASH_OP_SECTOR_ERASE},
+	{16 * 1024, 0, 0x50, FLASH_OP_BLOCK_ERASE},
+	{0}
+};
+
+static const struct erase_region geometry_sector_block64k[] = {
+	{4 * 1024, 0, 0x30, FLASH_OP_SECTOR_ERASE},
+	{64 * 1024, 0, 0x50, FLASH_OP_BLOCK_ERASE},
+	{0}
+};
+
+/* Top boot block: 64K blocks, then 32K, 8K, 8K and 16K at the top */
+static const struct erase_region geometry_49lfxxxc[] = {
+	{4 * 1024, 0, 0x30, FLASH_OP_SECTOR_ERASE},
+	{64 * 1024, 0, 0x20, FLASH_OP_BLOCK_ERASE},
+	{32 * 1024, 1, 0x20, FLASH_OP_BLOCK_ERASE},
+	{8 * 1024, 2, 0x20, FLASH_OP_BLOCK_ERASE},
+	{16 * 1024, 1, 0x20, FLASH_OP_BLOCK_ERASE},
+	{0}
+};
+
+static const struct erase_region geometry_m29f400bt[] = {
+	{64 * 1024, 7, 0x30, FLASH_OP_BLOCK_ERASE},
+	{32 * 1024, 1, 0x30, FLASH_OP_BLOCK_ERASE},
+	{8 * 1024, 2, 0x30, FLASH_OP_BLOCK_ERASE},
+	{16 * 1024, 1, 0x30, FLASH_OP_BLOCK_ERASE},
+	{0}
+};
+
+static const struct erase_region geometry_82802ab[] = {
+	{64 * 1024, 0, 0x20, FLASH_OP_BLOCK_ERASE},
+	{0}
+};
+
 struct flashchip flashchips[] = {
 	{"Am29F040B",	AMD_ID, 	AM_29F040B,	512, 64 * 1024,
-	 probe_29f040b, erase_29f040b,	write_29f040b},
+	 probe_29f040b, erase_29f040b,	write_29f040b, &timing_29f040b,
+	 geometry_29f040b},
 	{"Am29F016D",	AMD_ID, 	AM_29F016D,	2048, 64 * 1024,
-	 probe_29f040b, erase_29f040b,	write_29f040b},
+	 probe_29f040b, erase_29f040b,	write_29f040b, &timing_29f016d,
+	 geometry_29f040b, FEATURE_UNLOCK_BYPASS},
 	{"AE49F2008",	ASD_ID,	        ASD_AE49F2008,	256, 128,
 	 probe_jedec,	erase_chip_jedec, write_jedec},
 	{"At29C040A",	ATMEL_ID,	AT_29C040A,	512, 256,
-	 probe_jedec,	erase_chip_jedec, write_jedec},
+	 probe_jedec,	erase_chip_jedec, write_jedec, &timing_page_write,
+	 NULL, FEATURE_PAGE_WRITE},
 	{"At29C020",	ATMEL_ID,	AT_29C020,	256, 256,
-	 probe_jedec,	erase_chip_jedec, write_jedec},
+	 probe_jedec,	erase_chip_jedec, write_jedec, &timing_page_write,
+	 NULL, FEATURE_PAGE_WRITE},
 	{"Mx29f002",	MX_ID,		MX_29F002,	256, 64 * 1024,
 	 probe_29f002,	erase_29f002, 	write_29f002},
 	{"SST29EE020A", SST_ID,		SST_29EE020A,	256, 128,
-	 probe_jedec,	erase_chip_jedec, write_jedec},
+	 probe_jedec,	erase_chip_jedec, write_jedec, &timing_page_write,
+	 NULL, FEATURE_PAGE_WRITE},
 	{"SST28SF040A", SST_ID,		SST_28SF040,	512, 256,
 	 probe_28sf040, erase_28sf040, write_28sf040},
 	{"SST39SF010A", SST_ID,		SST_39SF010,	128, 4096,
-	 probe_jedec,	erase_chip_jedec, write_39sf020},
+	 probe_jedec,	erase_chip_jedec, write_39sf020, &timing_sst39sf,
+	 geometry_sector},
 	{"SST39SF020A", SST_ID,		SST_39SF020,	256, 4096,
-	 probe_jedec,	erase_chip_jedec, write_39sf020},
+	 probe_jedec,	erase_chip_jedec, write_39sf020, &timing_sst39sf,
+	 geometry_sector},
 	{"SST39SF040",  SST_ID,		SST_39SF040,	512, 4096,
-	 probe_jedec,	erase_chip_jedec, write_39sf020},
+	 probe_jedec,	erase_chip_jedec, write_39sf020, &timing_sst39sf,
+	 geometry_sector},
 	{"SST39VF020",	SST_ID,		SST_39VF020,	256, 4096,
-	 probe_jedec,	erase_chip_jedec, write_39sf020},
+	 probe_jedec,	erase_chip_jedec, write_39sf020, &timing_sst39sf,
+	 geometry_sector},
 // assume similar to 004B, ignoring data sheet
 	{"SST49LF040B",	SST_ID,		SST_49LF040B, 	512, 64 * 1024,
-	 probe_sst_fwhub, erase_sst_fwhub, write_sst_fwhub},
+	 probe_sst_fwhub, erase_sst_fwhub, write_sst_fwhub, &timing_sst49lf,
+	 geometry_sector_block64k},
 
 	{"SST49LF040",	SST_ID,		SST_49LF040, 	512, 4096,
-	 probe_jedec, 	erase_49lf040, write_49lf040},
+	 probe_jedec, 	erase_49lf040, write_49lf040, &timing_sst49lf,
+	 geometry_sector_block64k},
 	{"SST49LF020A",	SST_ID,		SST_49LF020A, 	256, 16 * 1024,
-	 probe_jedec, 	erase_49lf040, write_49lf040},
+	 probe_jedec, 	erase_49lf040, write_49lf040, &timing_sst49lf,
+	 geometry_sector_block16k},
 	{"SST49LF080A",	SST_ID,		SST_49LF080A,	1024, 4096,
-	 probe_jedec,	erase_49lf040, write_49lf040},
+	 probe_jedec,	erase_49lf040, write_49lf040, &timing_sst49lf,
+	 geometry_sector_block64k},
 	{"SST49LF002A/B", SST_ID,	SST_49LF002A,	256, 16 * 1024,
-	 probe_sst_fwhub, erase_sst_fwhub, write_sst_fwhub},
+	 probe_sst_fwhub, erase_sst_fwhub, write_sst_fwhub, &timing_sst49lf,
+	 geometry_sector_block16k},
 	{"SST49LF003A/B", SST_ID,	SST_49LF003A,	384, 64 * 1024,
-	 probe_sst_fwhub, erase_sst_fwhub, write_sst_fwhub},
+	 probe_sst_fwhub, erase_sst_fwhub, write_sst_fwhub, &timing_sst49lf,
+	 geometry_sector_block64k},
 	{"SST49LF004A/B", SST_ID,	SST_49LF004A,	512, 64 * 1024,
-	 probe_sst_fwhub, erase_sst_fwhub, write_sst_fwhub},
+	 probe_sst_fwhub, erase_sst_fwhub, write_sst_fwhub, &timing_sst49lf,
+	 geometry_sector_block64k},
 	{"SST49LF008A", SST_ID,		SST_49LF008A, 	1024, 64 * 1024 ,
-	 probe_sst_fwhub, erase_sst_fwhub, write_sst_fwhub},
+	 probe_sst_fwhub, erase_sst_fwhub, write_sst_fwhub, &timing_sst49lf,
+	 geometry_sector_block64k},
 	{"SST49LF004C", SST_ID,		SST_49LF004C,	512, 4 * 1024,
-	 probe_49lfxxxc, erase_49lfxxxc, write_49lfxxxc},
+	 probe_49lfxxxc, erase_49lfxxxc, write_49lfxxxc, &timing_sst49lf,
+	 geometry_49lfxxxc},
 	{"SST49LF008C", SST_ID,		SST_49LF008C, 	1024, 4 * 1024 ,
-	 probe_49lfxxxc, erase_49lfxxxc, write_49lfxxxc},
+	 probe_49lfxxxc, erase_49lfxxxc, write_49lfxxxc, &timing_sst49lf,
+	 geometry_49lfxxxc},
 	{"SST49LF016C", SST_ID,		SST_49LF016C, 	2048, 4 * 1024 ,
-	 probe_49lfxxxc, erase_49lfxxxc, write_49lfxxxc},
+	 probe_49lfxxxc, erase_49lfxxxc, write_49lfxxxc, &timing_sst49lf,
+	 geometry_49lfxxxc},
 	{"SST49LF160C", SST_ID,		SST_49LF160C, 	2048, 4 * 1024 ,
-	 probe_49lfxxxc, erase_49lfxxxc, write_49lfxxxc},
+	 probe_49lfxxxc, erase_49lfxxxc, write_49lfxxxc, &timing_sst49lf,
+	 geometry_49lfxxxc},
 	{"Pm49FL002",	PMC_ID,		PMC_49FL002,	256, 16 * 1024,
-	 probe_jedec,	erase_chip_jedec, write_49fl004},
+	 probe_jedec,	erase_chip_jedec, write_49fl004, NULL,
+	 geometry_sector_block16k},
 	{"Pm49FL004",	PMC_ID,		PMC_49FL004,	512, 64 * 1024,
-	 probe_jedec,	erase_chip_jedec, write_49fl004},
+	 probe_jedec,	erase_chip_jedec, write_49fl004, NULL,
+	 geometry_sector_block64k},
 	{"W29C011",	WINBOND_ID,	W_29C011,	128, 128,
-	 probe_jedec,	erase_chip_jedec, write_jedec},
+	 probe_jedec,	erase_chip_jedec, write_jedec, &timing_page_write,
+	 NULL, FEATURE_PAGE_WRITE},
 	{"W29C020C", 	WINBOND_ID, 	W_29C020C,	256, 128,
-	 probe_jedec, 	erase_chip_jedec, write_jedec},
+	 probe_jedec, 	erase_chip_jedec, write_jedec, &timing_page_write,
+	 NULL, FEATURE_PAGE_WRITE},
 	{"W49F002U", 	WINBOND_ID, 	W_49F002U,	256, 128,
 	 probe_jedec,	erase_chip_jedec, write_49f002},
 	{"W49V002A", 	WINBOND_ID, 	W_49V002A,	256, 128,
@@ -106,7 +205,8 @@ struct flashchip flashchips[] = {
 	{"W49V002FA", 	WINBOND_ID, 	W_49V002FA,	256, 128,
 	 probe_jedec,	erase_chip_jedec, write_49f002},
 	{"W39V040FA", 	WINBOND_ID, 	W_39V040FA,	512, 64*1024,
-	 probe_jedec,	erase_chip_jedec, write_39v040fa},
+	 probe_jedec,	erase_chip_jedec, write_39v040fa, NULL,
+	 geometry_sector_block64k},
 	{"W39V040A", 	WINBOND_ID, 	W_39V040A,	512, 64*1024,
 	 probe_jedec,	erase_chip_jedec, write_39sf020},
 	{"W39V040B",    WINBOND_ID,     W_39V040B,      512, 64*1024,
@@ -118,11 +218,13 @@ struct flashchip flashchips[] = {
 	{"M50FW040",	ST_ID, 		ST_M50FW040,	512, 64 * 1024,
 	 probe_jedec,	erase_chip_jedec, write_jedec},
 	{"M29W040B",	ST_ID, 		ST_M29W040B,	512, 64 * 1024,
-	 probe_jedec,	erase_chip_jedec, write_jedec},
+	 probe_29f040b, erase_29f040b,	write_29f040b, NULL,
+	 geometry_29f040b, FEATURE_UNLOCK_BYPASS},
 	{"M29F002T/NT",	ST_ID, 		ST_M29F002T,	256, 64 * 1024,
 	 probe_jedec,	erase_chip_jedec, write_jedec},
 	{"M29F400BT",	ST_ID,		ST_M29F400BT,	512, 64 * 1024,
-	 probe_m29f400bt, erase_m29f400bt, write_linuxbios_m29f400bt},
+	 probe_m29f400bt, erase_m29f400bt, write_linuxbios_m29f400bt, NULL,
+	 geometry_m29f400bt},
 	{"M50FLW040A",	ST_ID,		ST_M50FLW040A,	512,	64 * 1024,
 	 probe_jedec,	erase_chip_jedec,	write_jedec},
 	{"M50FLW040B",	ST_ID,		ST_M50FLW040B,	512,	64 * 1024,
@@ -140,17 +242,19 @@ struct flashchip flashchips[] = {
 	{"M29W010B",	ST_ID,		ST_M29W010B,	128,	16 * 1024,
 	 probe_jedec,	erase_chip_jedec,	write_jedec},
 	{"M29F040B",	ST_ID, 		ST_M29F040B,	512, 64 * 1024,
-	 probe_29f040b, erase_29f040b,	write_29f040b},
+	 probe_29f040b, erase_29f040b,	write_29f040b, &timing_29f040b,
+	 geometry_29f040b, FEATURE_UNLOCK_BYPASS},
 	{"82802ab",	137,		173,		512, 64 * 1024,
-	 probe_82802ab, erase_82802ab,	write_82802ab},
+	 probe_82802ab, erase_82802ab,	write_82802ab, NULL, geometry_82802ab},
 	{"82802ac",	137,		172,		1024, 64 * 1024,
-	 probe_82802ab, erase_82802ab,	write_82802ab},
+	 probe_82802ab, erase_82802ab,	write_82802ab, NULL, geometry_82802ab},
 	{"F49B002UA",   EMST_ID,        EMST_F49B002UA, 256, 4096,
          probe_jedec,   erase_chip_jedec, write_49f002},
 #ifndef DISABLE_DOC
 	{"MD-2802 (M-Systems DiskOnChip Millennium Module)",
 	 		MSYSTEMS_ID,	MSYSTEMS_MD2802,8, 8 * 1024,
-	 probe_md2802, erase_md2802, write_md2802, read_md2802},
+	 probe_md2802, erase_md2802, write_md2802, NULL, NULL, 0,
+	 read_md2802},
 #endif
 	{"LHF00L04",	SHARP_ID,	SHARP_LHF00L04,	1024, 64 * 1024,
 	 probe_lhf00l04, erase_lhf00l04,  write_lhf00l04},
@@ -54,11 +54,16 @@
 #include "flash.h"
 #include "lbtable.h"
 #include "layout.h"
+#include "udelay.h"
+#include "verify.h"
+#include "writeplan.h"
+#include "sim.h"
+#include "stats.h"
+#include "trace.h"
 #include "debug.h"
 
 char *chip_to_probe = NULL;
 struct pci_access *pacc;	/* For board and chipset_enable */
-int exclude_start_page, exclude_end_page;
 int force = 0, verbose = 0;
 
 int fd_mem;
@@ -109,9 +114,19 @@ int map_flash_registers(struct flashchip *flash)
 {
 	volatile uint8_t *registers;
 	size_t size = flash->total_size * 1024;
+	unsigned long base = 0xFFFFFFFF - 0x400000 - size + 1;
+
+	if (sim_active) {
+		registers = sim_map(base, size);
+		if (registers == NULL)
+			exit(1);
+		trace_map(registers, base, size);
+		flash->virtual_registers = registers;
+		return 0;
+	}
 
 #ifdef __MINGW32_VERSION
-	registers = map_physical_addr_range((0xFFFFFFFF - 0x400000 - size + 1), size);
+	registers = map_physical_addr_range(base, size);
  	if (registers == NULL) {
  		perror("Can't map registers");
  		cleanup_driver();
@@ -119,7 +134,7 @@ int map_flash_registers(struct flashchip *flash)
  	}
 #else
 	registers = mmap(0, size, PROT_WRITE | PROT_READ, MAP_SHARED,
-			 fd_mem, (off_t) (0xFFFFFFFF - 0x400000 - size + 1));
+			 fd_mem, (off_t) base);
 
 	if (registers == MAP_FAILED) {
 		perror("Can't mmap registers using " MEM_DEV);
@@ -127,116 +142,343 @@ int map_flash_registers(struct flashchip *flash)
 	}
 #endif
 	
+	trace_map(registers, base, size);
 	flash->virtual_registers = registers;
 
 	return 0;
 }
 
-struct flashchip *probe_flash(struct flashchip *flash)
+static volatile uint8_t *map_flash_window(unsigned long base,
+					  unsigned long size)
+{
+	volatile uint8_t *bios;
+
+	if (sim_active) {
+		if ((bios = sim_map(base, size)) == NULL)
+			exit(1);
+		trace_map(bios, base, size);
+		return bios;
+	}
+
+#ifdef	__MINGW32_VERSION
+	bios = map_physical_addr_range(base, size);
+	if (bios == NULL) {
+		perror("Can't map bios chip");
+		cleanup_driver();
+		exit(1);
+	}
+#else
+	bios = mmap(0, size, PROT_WRITE | PROT_READ, MAP_SHARED,
+		    fd_mem, (off_t) base);
+	if (bios == MAP_FAILED) {
+		perror("Can't mmap memory using " MEM_DEV);
+		exit(1);
+	}
+#endif //__MINGW32_VERSION
+
+	trace_map(bios, base, size);
+	return bios;
+}
+
+static void unmap_flash_window(volatile uint8_t *bios, unsigned long size)
 {
+	trace_unmap(bios);
+	if (sim_active) {
+		sim_unmap(bios);
+		return;
+	}
+#ifdef	__MINGW32_VERSION
+	unmap_physical_addr_range((void *)bios, size);
+#else
+	munmap((void *)bios, size);
+#endif
+}
+
+/*
+ * ID reads done while probing. Most chips share a probe method, and the
+ * method reads the same two ID bytes no matter which entry it is called
+ * for, so the reads are cached per (method, address) for the duration of
+ * probe_flash(). last_probe_id is the ID seen by the most recent probe.
+ */
+#define MAX_PROBE_IDS	16
+
+struct probe_id {
+	int (*method) (struct flashchip *flash);
 	volatile uint8_t *bios;
-	unsigned long flash_baseaddr, size;
+	uint8_t id1, id2;
+};
+
+static struct probe_id probe_ids[MAX_PROBE_IDS];
+static int num_probe_ids = 0;
+static struct probe_id *last_probe_id = NULL;
+
+int probe_id_cached(int (*method) (struct flashchip *flash),
+		    volatile uint8_t *bios, uint8_t *id1, uint8_t *id2)
+{
+	int i;
 
-	while (flash->name != NULL) {
-		if (chip_to_probe && strcmp(flash->name, chip_to_probe) != 0) {
-			flash++;
+	for (i = 0; i < num_probe_ids; i++) {
+		if (probe_ids[i].method != method || probe_ids[i].bios != bios)
 			continue;
-		}
-		printf_debug("Probing for %s, %d KB\n",
-			     flash->name, flash->total_size);
+		*id1 = probe_ids[i].id1;
+		*id2 = probe_ids[i].id2;
+		last_probe_id = &probe_ids[i];
+		return 1;
+	}
+
+	return 0;
+}
+
+void probe_id_store(int (*method) (struct flashchip *flash),
+		    volatile uint8_t *bios, uint8_t id1, uint8_t id2)
+{
+	if (num_probe_ids == MAX_PROBE_IDS)
+		return;
+
+	probe_ids[num_probe_ids].method = method;
+	probe_ids[num_probe_ids].bios = bios;
+	probe_ids[num_probe_ids].id1 = id1;
+	probe_ids[num_probe_ids].id2 = id2;
+	last_probe_id = &probe_ids[num_probe_ids++];
+}
+
+/*
+ * Index of the candidate chips keyed on (probe method, vendor, device).
+ * Chains keep flashchips[] order, so a lookup finds the first entry that
+ * matches, just like a linear scan would.
+ */
+#define PROBE_HASH_SIZE	64
+
+struct probe_entry {
+	struct flashchip *flash;
+	struct probe_entry *next;
+};
+
+static unsigned int probe_hash(int (*method) (struct flashchip *flash),
+			       int vendor, int device)
+{
+	unsigned long h = (unsigned long)method;
+
+	h = (h >> 4) ^ (h >> 12);
+	h = h * 31 + (vendor & 0xff);
+	h = h * 31 + (device & 0xff);
+
+	return h % PROBE_HASH_SIZE;
+}
+
+static struct flashchip *probe_lookup(struct probe_entry **index,
+				      int (*method) (struct flashchip *flash),
+				      int size, int vendor, int device)
+{
+	struct probe_entry *e;
+
+	for (e = index[probe_hash(method, vendor, device)]; e; e = e->next) {
+		if (e->flash->probe == method &&
+		    e->flash->total_size == size &&
+		    (e->flash->manufacture_id & 0xff) == vendor &&
+		    (e->flash->model_id & 0xff) == device)
+			return e->flash;
+	}
+
+	return NULL;
+}
+
+/*
+ * Every candidate chip ends at the top of the 4 GB space, so a single
+ * window as large as the biggest candidate contains all of them. Map it
+ * once and hand each probe the sub-view at the right offset, instead of
+ * mapping and unmapping a window per flashchips[] entry. The window
+ * stays mapped for the chip that matches.
+ *
+ * Candidates are probed in groups of the same probe method and size:
+ * the first entry of a group reads the ID, and the rest of the group is
+ * resolved through the index. Probe methods that do not report their ID
+ * still have each group member probed in turn.
+ */
+struct flashchip *probe_flash(struct flashchip *flash)
+{
+	struct flashchip *f, *g, *match = NULL;
+	struct probe_entry *index[PROBE_HASH_SIZE], *entries, **tail;
+	volatile uint8_t *window;
+	unsigned long flash_baseaddr, window_baseaddr, window_size = 0;
+	int i, nchips = 0;
+	uint8_t *done;
+
+	for (f = flash; f->name != NULL; f++) {
+		nchips++;
+		if (chip_to_probe && strcmp(f->name, chip_to_probe) != 0)
+			continue;
+		if (f->total_size * 1024 > window_size)
+			window_size = f->total_size * 1024;
+	}
+	if (window_size == 0)
+		return NULL;
 
-		size = flash->total_size * 1024;
+	entries = malloc(nchips * sizeof(struct probe_entry));
+	done = calloc(nchips, sizeof(uint8_t));
+	if (entries == NULL || done == NULL) {
+		fprintf(stderr, "Error: Out of memory for the probe index\n");
+		exit(1);
+	}
+
+	memset(index, 0, sizeof(index));
+	for (i = 0; i < nchips; i++) {
+		f = &flash[i];
+		if (chip_to_probe && strcmp(f->name, chip_to_probe) != 0)
+			continue;
+		entries[i].flash = f;
+		entries[i].next = NULL;
+		tail = &index[probe_hash(f->probe, f->manufacture_id & 0xff,
+					 f->model_id & 0xff)];
+		while (*tail)
+			tail = &(*tail)->next;
+		*tail = &entries[i];
+	}
+
+#ifndef	__MINGW32_VERSION
+	/* If getpagesize() > size -> 
+	 * "Can't mmap memory using /dev/mem: Invalid argument"
+	 * This should never happen as we don't support any flash chips
+	 * smaller than 4k or 8k (yet).
+	 */
+	if (getpagesize() > window_size) {
+		printf("WARNING: size: %ld -> %ld (page size)\n",
+		       window_size, (unsigned long)getpagesize());
+		window_size = getpagesize();
+	}
+#endif
 
 #ifdef TS5300
-		// FIXME: Wrong place for this decision
-		// FIXME: This should be autodetected. It is trivial.
-		flash_baseaddr = 0x9400000;
+	// FIXME: Wrong place for this decision
+	// FIXME: This should be autodetected. It is trivial.
+	window_baseaddr = 0x9400000;
 #else
-		flash_baseaddr = (0xffffffff - size + 1);
+	window_baseaddr = (0xffffffff - window_size + 1);
 #endif
+	window = map_flash_window(window_baseaddr, window_size);
 
-#ifdef	__MINGW32_VERSION	
-		bios = map_physical_addr_range(flash_baseaddr, size);
-		if (bios == NULL) {
- 			perror("Can't map bios chip");
- 			cleanup_driver();
-			exit(1);
-		}
+	num_probe_ids = 0;
+
+	for (i = 0; i < nchips && match == NULL; i++) {
+		f = &flash[i];
+		if (done[i])
+			continue;
+		if (chip_to_probe && strcmp(f->name, chip_to_probe) != 0)
+			continue;
+
+		printf_debug("Probing for %s, %d KB\n",
+			     f->name, f->total_size);
+
+#ifdef TS5300
+		flash_baseaddr = window_baseaddr;
 #else
-		/* If getpagesize() > size -> 
-		 * "Can't mmap memory using /dev/mem: Invalid argument"
-		 * This should never happen as we don't support any flash chips
-		 * smaller than 4k or 8k (yet).
-		 */
+		flash_baseaddr = (0xffffffff - f->total_size * 1024 + 1);
+#endif
 
-		if (getpagesize() > size) {
-			size = getpagesize();
-			printf("WARNING: size: %d -> %ld (page size)\n",
-			       flash->total_size * 1024, (unsigned long)size);
+		last_probe_id = NULL;
+		f->virtual_memory = window + (flash_baseaddr - window_baseaddr);
+		if (f->probe(f) == 1) {
+			match = f;
+			break;
 		}
-
-		bios = mmap(0, size, PROT_WRITE | PROT_READ, MAP_SHARED,
-			    fd_mem, (off_t) flash_baseaddr);
-		if (bios == MAP_FAILED) {
-			perror("Can't mmap memory using " MEM_DEV);
-			exit(1);
+		f->virtual_memory = NULL;
+
+		if (last_probe_id != NULL) {
+			/* One ID read settles the whole group */
+			g = probe_lookup(index, f->probe, f->total_size,
+					 last_probe_id->id1,
+					 last_probe_id->id2);
+			if (g != NULL) {
+				printf_debug("Probing for %s, %d KB\n",
+					     g->name, g->total_size);
+				g->virtual_memory = window +
+				    (flash_baseaddr - window_baseaddr);
+				if (g->probe(g) == 1)
+					match = g;
+				else
+					g->virtual_memory = NULL;
+			}
+			for (g = f; g->name != NULL; g++)
+				if (g->probe == f->probe &&
+				    g->total_size == f->total_size)
+					done[g - flash] = 1;
 		}
-#endif //__MINGW32_VERSION
-		flash->virtual_memory = bios;
+	}
 
-		if (flash->probe(flash) == 1) {
-			printf("%s found at physical address: 0x%lx\n",
-			       flash->name, flash_baseaddr);
-			return flash;
-		}
+	num_probe_ids = 0;
+	free(entries);
+	free(done);
 
-#ifdef	__MINGW32_VERSION
-		unmap_physical_addr_range((void*)bios, size);	
-#else	
-		munmap((void *)bios, size);
-#endif
-		flash++;
+	if (match == NULL) {
+		unmap_flash_window(window, window_size);
+		return NULL;
 	}
-	return NULL;
+
+	printf("%s found at physical address: 0x%lx\n",
+	       match->name, flash_baseaddr);
+	return match;
 }
 
+/* Without -V only this many mismatching ranges are listed */
+#define MAX_REPORTED_RANGES	16
+
 int verify_flash(struct flashchip *flash, uint8_t *buf)
 {
-	int idx;
-	int total_size = flash->total_size * 1024;
-	volatile uint8_t *bios = flash->virtual_memory;
+	struct flash_range *ranges;
+	unsigned int bad = 0;
+	int i, nranges;
 
 	printf("Verifying flash ");
 
-	if (verbose)
-		printf("address: 0x00000000\b\b\b\b\b\b\b\b\b\b");
+	nranges = compare_flash(flash, buf, &ranges);
+	if (nranges < 0) {
+		printf("- FAILED\n");
+		return 1;
+	}
+	if (nranges == 0) {
+		printf("- VERIFIED         \n");
+		return 0;
+	}
 
-	for (idx = 0; idx < total_size; idx++) {
-		if (verbose && ((idx & 0xfff) == 0xfff))
-			printf("0x%08x", idx);
+	for (i = 0; i < nranges; i++)
+		bad += ranges[i].len;
+	printf("- FAILED: %u bytes differ in %d ranges\n", bad, nranges);
 
-		if (*(bios + idx) != *(buf + idx)) {
-			if (verbose) {
-				printf("0x%08x ", idx);
-			}
-			printf("- FAILED\n");
-			return 1;
+	for (i = 0; i < nranges; i++) {
+		if (!verbose && i == MAX_REPORTED_RANGES) {
+			printf("  ... %d more, use -V to list them all\n",
+			       nranges - i);
+			break;
 		}
-
-		if (verbose && ((idx & 0xfff) == 0xfff))
-			printf("\b\b\b\b\b\b\b\b\b\b");
+		printf("  0x%08x-0x%08x (%u bytes", ranges[i].start,
+		       ranges[i].start + ranges[i].len - 1, ranges[i].len);
+		if (ranges[i].block_size)
+			printf(", erase block 0x%08x-0x%08x",
+			       ranges[i].block_start,
+			       ranges[i].block_start + ranges[i].block_size - 1);
+		printf(")\n");
 	}
-	if (verbose)
-		printf("\b\b\b\b\b\b\b\b\b\b ");
 
-	printf("- VERIFIED         \n");
-	return 0;
+	free(ranges);
+	return 1;
+}
+
+static void print_stats_text(void)
+{
+	print_stats(0);
+}
+
+static void print_stats_json(void)
+{
+	print_stats(1);
 }
 
 void usage(const char *name)
 {
 	printf("usage: %s [-rwvEVfh] [-c chipname] [-s exclude_start]\n", name);
-	printf("       [-e exclude_end] [-m vendor:part] [-l file.layout] [-i imagename] [file]\n");
+	printf("       [-e exclude_end] [-m vendor:part] [-l file.layout] [-i imagename]\n");
+	printf("       [-T usec] [-S chipname[,option=value...]] [-C[json]]\n");
+	printf("       [-t file[,records]] [file]\n");
 	printf
 	    ("   -r | --read:                    read flash and save into file\n"
 	     "   -w | --write:                   write file into flash (default when\n"
@@ -251,6 +493,17 @@ void usage(const char *name)
 	     "   -f | --force:                   force write without checking image\n"
 	     "   -l | --layout <file.layout>:    read rom layout from file\n"
 	     "   -i | --image <name>:            only flash image name from flash layout\n"
+	     "   -T | --sleep-threshold <usec>:  sleep instead of spinning for waits of\n"
+	     "                                   at least usec (default 1000, 0 = never)\n"
+	     "   -S | --simulate <chipname,...>: use a simulated chip instead of the\n"
+	     "                                   hardware; options: image=<file>,\n"
+	     "                                   program=, sector=, block=, chip=<usec>,\n"
+	     "                                   access=<nsec>\n"
+	     "   -C | --stats[=json]:            print bus access and delay counters\n"
+	     "                                   at exit\n"
+	     "   -t | --trace <file>[,records]:  record flash and port I/O cycles in a\n"
+	     "                                   ring of records (default 1048576) and\n"
+	     "                                   write them to file at exit\n"
 	     "\n" " If no file is specified, then all that happens\n"
 	     " is that flash info is dumped.\n\n");
 	exit(1);
@@ -262,7 +515,8 @@ int main(int argc, char *argv[])
 	unsigned long size;
 	FILE *image;
 	struct flashchip *flash;
-	int opt;
+	struct layout_range *keep = NULL;
+	int opt, i, nkeep;
 	int option_index = 0;
 	int read_it = 0, write_it = 0, erase_it = 0, verify_it = 0;
 	int ret = 0;
@@ -280,6 +534,10 @@ int main(int argc, char *argv[])
 		{"force", 0, 0, 'f'},
 		{"layout", 1, 0, 'l'},
 		{"image", 1, 0, 'i'},
+		{"sleep-threshold", 1, 0, 'T'},
+		{"simulate", 1, 0, 'S'},
+		{"stats", 2, 0, 'C'},
+		{"trace", 1, 0, 't'},
 		{"help", 0, 0, 'h'},
 		{0, 0, 0, 0}
 	};
@@ -298,7 +556,7 @@ int main(int argc, char *argv[])
 	}
 
 	setbuf(stdout, NULL);
-	while ((opt = getopt_long(argc, argv, "rwvVEfc:s:e:m:l:i:h",
+	while ((opt = getopt_long(argc, argv, "rwvVEfc:s:e:m:l:i:T:S:C::t:h",
 				  long_options, &option_index)) != EOF) {
 		switch (opt) {
 		case 'r':
@@ -351,6 +609,26 @@ int main(int argc, char *argv[])
 			tempstr = strdup(optarg);
 			find_romentry(tempstr);
 			break;
+		case 'T':
+			myusec_set_sleep_threshold(strtol(optarg, NULL, 0));
+			break;
+		case 'S':
+			if (sim_init(optarg))
+				exit(1);
+			printf("Simulating %s\n", sim_chip_name());
+			if (chip_to_probe == NULL)
+				chip_to_probe = strdup(sim_chip_name());
+			break;
+		case 'C':
+			if (optarg && !strcmp(optarg, "json"))
+				atexit(print_stats_json);
+			else
+				atexit(print_stats_text);
+			break;
+		case 't':
+			if (trace_init(optarg))
+				exit(1);
+			break;
 		case 'h':
 		default:
 			usage(argv[0]);
@@ -378,44 +656,48 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 */
+	/* The simulator needs neither the driver nor any flash enables */
+	if (!sim_active) {
 #ifdef __MINGW32_VERSION
- 	if( init_driver() == 0)
- 	{
- 		printf("Error: failed to initialize driver interface\n");
- 		exit(1);
- 	}
+		if (init_driver() == 0) {
+			printf("Error: failed to initialize driver interface\n");
+			exit(1);
+		}
 #endif
-	/* Initialize PCI access for flash enables */
-	pacc = pci_alloc();	/* Get the pci_access structure */
-	/* Set all options you want -- here we stick with the defaults */
-	pci_init(pacc);		/* Initialize the PCI library */
-	pci_scan_bus(pacc);	/* We want to get the list of devices */
-
-#ifndef __MINGW32_VERSION	
-	/* Open the memory device. A lot of functions need it */
-	if ((fd_mem = open(MEM_DEV, O_RDWR)) < 0) {
-		perror("Error: Can not access memory using " MEM_DEV
-		       ". You need to be root.");
-		exit(1);
-	}
+		/* Initialize PCI access for flash enables */
+		pacc = pci_alloc();	/* Get the pci_access structure */
+		/* Set all options you want -- here we stick with the defaults */
+		pci_init(pacc);		/* Initialize the PCI library */
+		pci_scan_bus(pacc);	/* We want to get the list of devices */
+
+#ifndef __MINGW32_VERSION
+		/* Open the memory device. A lot of functions need it */
+		if ((fd_mem = open(MEM_DEV, O_RDWR)) < 0) {
+			perror("Error: Can not access memory using " MEM_DEV
+			       ". You need to be root.");
+			exit(1);
+		}
 #endif
+	}
 	myusec_calibrate_delay();
 
-	/* We look at the lbtable first to see if we need a
-	 * mainboard specific flash enable sequence.
-	 */
-	linuxbios_init();
+	if (!sim_active) {
+		/* We look at the lbtable first to see if we need a
+		 * mainboard specific flash enable sequence.
+		 */
+		linuxbios_init();
 
-	/* try to enable it. Failure IS an option, since not all motherboards
-	 * really need this to be done, etc., etc.
-	 */
-	ret = chipset_flash_enable();
-	if (ret == -2) {
-		printf("WARNING: No chipset found. Flash detection "
-		       "will most likely fail.\n");
-	}
+		/* try to enable it. Failure IS an option, since not all
+		 * motherboards really need this to be done, etc., etc.
+		 */
+		ret = chipset_flash_enable();
+		if (ret == -2) {
+			printf("WARNING: No chipset found. Flash detection "
+			       "will most likely fail.\n");
+		}
 
-	board_flash_enable(lb_vendor, lb_part);
+		board_flash_enable(lb_vendor, lb_part);
+	}
 
 	if ((flash = probe_flash(flashchips)) == NULL) {
 		printf("No EEPROM/flash device found.\n");
@@ -426,6 +708,7 @@ int main(int argc, char *argv[])
 	}
 
 	printf("Flash part is %s (%d KB)\n", flash->name, flash->total_size);
+	trace_set_chip(flash->name);
 
 	if (!filename && !erase_it) {
 		// FIXME: Do we really want this feature implicitly?
@@ -456,7 +739,7 @@ int main(int argc, char *argv[])
 		}
 		printf("Reading Flash...");
 		if (flash->read == NULL)
-			memcpy(buf, (const char *)flash->virtual_memory, size);
+			chip_readn(buf, flash->virtual_memory, size);
 		else
 			flash->read(flash, buf);
 
@@ -497,32 +780,44 @@ int main(int argc, char *argv[])
 		fclose(image);
 	}
 
-	/* exclude range stuff. Nice idea, but at the moment it is only
-	 * supported in hardware by the pm49fl004 chips. 
-	 * Instead of implementing this for all chips I suggest advancing
-	 * it to the rom layout feature below and drop exclude range
-	 * completely once all flash chips can do rom layouts. stepan
+	/* The exclude range and the layout both keep parts of the chip:
+	 * their current contents are merged into the image, and the
+	 * pages they cover are cleared in the write mask so the drivers
+	 * do not erase or program them at all.
 	 */
-
-	// ////////////////////////////////////////////////////////////
-	if (exclude_end_position - exclude_start_position > 0)
-		memcpy(buf + exclude_start_position,
-		       (const char *)flash->virtual_memory +
-		       exclude_start_position,
-		       exclude_end_position - exclude_start_position);
-
-	exclude_start_page = exclude_start_position / flash->page_size;
-	if ((exclude_start_position % flash->page_size) != 0) {
-		exclude_start_page++;
+	if (exclude_end_position - exclude_start_position > 0) {
+		chip_readn(buf + exclude_start_position,
+			   flash->virtual_memory + exclude_start_position,
+			   exclude_end_position - exclude_start_position);
+		if (write_mask_exclude(flash, exclude_start_position,
+				       exclude_end_position - 1) < 0) {
+#ifdef __MINGW32_VERSION
+			cleanup_driver();
+#endif
+			exit(1);
+		}
 	}
-	exclude_end_page = exclude_end_position / flash->page_size;
-	// ////////////////////////////////////////////////////////////
 
-	// This should be moved into each flash part's code to do it 
-	// cleanly. This does the job.
-	handle_romentries(buf, (uint8_t *) flash->virtual_memory);
-
-	// ////////////////////////////////////////////////////////////
+	nkeep = layout_keep_ranges(&keep);
+	if (nkeep < 0 ||
+	    handle_romentries(buf, flash->virtual_memory, size, keep,
+			      nkeep) < 0) {
+		free(keep);
+#ifdef __MINGW32_VERSION
+		cleanup_driver();
+#endif
+		exit(1);
+	}
+	for (i = 0; i < nkeep; i++) {
+		if (write_mask_exclude(flash, keep[i].start, keep[i].end) < 0) {
+			free(keep);
+#ifdef __MINGW32_VERSION
+			cleanup_driver();
+#endif
+			exit(1);
+		}
+	}
+	free(keep);
 
 	if (write_it)
 		ret |= flash->write(flash, buf);
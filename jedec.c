@@ -29,34 +29,150 @@
 #include <stdint.h>
 #include "flash.h"
 #include "jedec.h"
+#include "writeplan.h"
 #include "debug.h"
 
 #define MAX_REFLASH_TRIES 0x10
 
+/* Used for chips without a timing table and for fields a table leaves
+ * at zero. The maxima are generous enough for every part we support.
+ */
+static const struct flashchip_timing default_timing = {
+	0, 10 * 1000,
+	0, 64 * 1000 * 1000,
+	0, 64 * 1000 * 1000,
+	0, 256 * 1000 * 1000
+};
+
+void flash_op_timing(struct flashchip *flash, enum flash_op op,
+		     unsigned long *typ, unsigned long *max)
+{
+	const struct flashchip_timing *t = flash->timing;
+	const struct flashchip_timing *d = &default_timing;
+
+	if (t == NULL)
+		t = d;
+
+	switch (op) {
+	case FLASH_OP_PROGRAM:
+		*typ = t->program_typ;
+		*max = t->program_max ? t->program_max : d->program_max;
+		break;
+	case FLASH_OP_SECTOR_ERASE:
+		*typ = t->sector_erase_typ;
+		*max = t->sector_erase_max ? t->sector_erase_max :
+		    d->sector_erase_max;
+		break;
+	case FLASH_OP_BLOCK_ERASE:
+		*typ = t->block_erase_typ;
+		*max = t->block_erase_max ? t->block_erase_max :
+		    d->block_erase_max;
+		break;
+	case FLASH_OP_CHIP_ERASE:
+	default:
+		*typ = t->chip_erase_typ;
+		*max = t->chip_erase_max ? t->chip_erase_max :
+		    d->chip_erase_max;
+		break;
+	}
+}
+
+/*
+ * Shared busy wait for the embedded program/erase algorithms. Nothing
+ * can finish much before the typical time, so half of that window is
+ * slept through without touching the bus. After that the status bit is
+ * polled with a delay that doubles from 1us up to an eighth of the
+ * typical time (bounded to 10ms), and the operation is given up once
+ * the data sheet maximum has passed.
+ */
+static int wait_ready_jedec(struct flashchip *flash, volatile uint8_t *dst,
+			    uint8_t data, int toggle, enum flash_op op)
+{
+	unsigned long typ, max, elapsed, step, max_step;
+	uint8_t tmp1, tmp2;
+
+	flash_op_timing(flash, op, &typ, &max);
+
+	elapsed = typ / 2;
+	if (elapsed)
+		myusec_delay(elapsed);
+
+	max_step = typ / 8;
+	if (max_step < 1)
+		max_step = 1;
+	if (max_step > 10000)
+		max_step = 10000;
+
+	tmp1 = chip_readb(dst);
+	for (step = 1;; ) {
+		tmp2 = chip_readb(dst);
+		if (toggle) {
+			/* DQ6 stops toggling once the chip is done */
+			if ((tmp1 & 0x40) == (tmp2 & 0x40))
+				return 0;
+		} else {
+			/* DQ7 shows the true data once the chip is done */
+			if ((tmp2 & 0x80) == (data & 0x80))
+				return 0;
+		}
+		tmp1 = tmp2;
+
+		if (elapsed >= max)
+			break;
+		myusec_delay(step);
+		elapsed += step;
+		if (step < max_step)
+			step <<= 1;
+		if (step > max_step)
+			step = max_step;
+	}
+
+	fprintf(stderr, "Error: %s still busy after %lu us at 0x%08lx\n",
+		flash->name, max,
+		(unsigned long)(dst - flash->virtual_memory));
+	return -1;
+}
+
+int toggle_ready_jedec(struct flashchip *flash, volatile uint8_t *dst,
+		       enum flash_op op)
+{
+	return wait_ready_jedec(flash, dst, 0, 1, op);
+}
+
+int data_polling_jedec(struct flashchip *flash, volatile uint8_t *dst,
+		       uint8_t data, enum flash_op op)
+{
+	return wait_ready_jedec(flash, dst, data, 0, op);
+}
+
 int probe_jedec(struct flashchip *flash)
 {
 	volatile uint8_t *bios = flash->virtual_memory;
 	uint8_t id1, id2;
 
-	/* Issue JEDEC Product ID Entry command */
-	*(volatile uint8_t *)(bios + 0x5555) = 0xAA;
-	myusec_delay(10);
-	*(volatile uint8_t *)(bios + 0x2AAA) = 0x55;
-	myusec_delay(10);
-	*(volatile uint8_t *)(bios + 0x5555) = 0x90;
-	myusec_delay(10);
-
-	/* Read product ID */
-	id1 = *(volatile uint8_t *)bios;
-	id2 = *(volatile uint8_t *)(bios + 0x01);
-
-	/* Issue JEDEC Product ID Exit command */
-	*(volatile uint8_t *)(bios + 0x5555) = 0xAA;
-	myusec_delay(10);
-	*(volatile uint8_t *)(bios + 0x2AAA) = 0x55;
-	myusec_delay(10);
-	*(volatile uint8_t *)(bios + 0x5555) = 0xF0;
-	myusec_delay(10);
+	if (!probe_id_cached(probe_jedec, bios, &id1, &id2)) {
+		/* Issue JEDEC Product ID Entry command */
+		chip_writeb(0xAA, bios + 0x5555);
+		myusec_delay(10);
+		chip_writeb(0x55, bios + 0x2AAA);
+		myusec_delay(10);
+		chip_writeb(0x90, bios + 0x5555);
+		myusec_delay(10);
+
+		/* Read product ID */
+		id1 = chip_readb(bios);
+		id2 = chip_readb(bios + 0x01);
+
+		/* Issue JEDEC Product ID Exit command */
+		chip_writeb(0xAA, bios + 0x5555);
+		myusec_delay(10);
+		chip_writeb(0x55, bios + 0x2AAA);
+		myusec_delay(10);
+		chip_writeb(0xF0, bios + 0x5555);
+		myusec_delay(10);
+
+		probe_id_store(probe_jedec, bios, id1, id2);
+	}
 
 	printf_debug("%s: id1 0x%x, id2 0x%x\n", __FUNCTION__, id1, id2);
 	if (id1 == flash->manufacture_id && id2 == flash->model_id)
@@ -65,50 +181,48 @@ int probe_jedec(struct flashchip *flash)
 	return 0;
 }
 
-int erase_sector_jedec(volatile uint8_t *bios, unsigned int page)
+int erase_sector_jedec(struct flashchip *flash, unsigned int page)
 {
+	volatile uint8_t *bios = flash->virtual_memory;
+
 	/*  Issue the Sector Erase command   */
-	*(volatile uint8_t *)(bios + 0x5555) = 0xAA;
+	chip_writeb(0xAA, bios + 0x5555);
 	myusec_delay(10);
-	*(volatile uint8_t *)(bios + 0x2AAA) = 0x55;
+	chip_writeb(0x55, bios + 0x2AAA);
 	myusec_delay(10);
-	*(volatile uint8_t *)(bios + 0x5555) = 0x80;
+	chip_writeb(0x80, bios + 0x5555);
 	myusec_delay(10);
 
-	*(volatile uint8_t *)(bios + 0x5555) = 0xAA;
-	myusec_delay(10);
-	*(volatile uint8_t *)(bios + 0x2AAA) = 0x55;
+	chip_writeb(0xAA, bios + 0x5555);
 	myusec_delay(10);
-	*(volatile uint8_t *)(bios + page) = 0x30;
+	chip_writeb(0x55, bios + 0x2AAA);
 	myusec_delay(10);
+	chip_writeb(0x30, bios + page);
 
 	/* wait for Toggle bit ready         */
-	toggle_ready_jedec(bios);
-
-	return (0);
+	return toggle_ready_jedec(flash, bios, FLASH_OP_SECTOR_ERASE);
 }
 
-int erase_block_jedec(volatile uint8_t *bios, unsigned int block)
+int erase_block_jedec(struct flashchip *flash, unsigned int block)
 {
+	volatile uint8_t *bios = flash->virtual_memory;
+
 	/*  Issue the Sector Erase command   */
-	*(volatile uint8_t *)(bios + 0x5555) = 0xAA;
+	chip_writeb(0xAA, bios + 0x5555);
 	myusec_delay(10);
-	*(volatile uint8_t *)(bios + 0x2AAA) = 0x55;
+	chip_writeb(0x55, bios + 0x2AAA);
 	myusec_delay(10);
-	*(volatile uint8_t *)(bios + 0x5555) = 0x80;
+	chip_writeb(0x80, bios + 0x5555);
 	myusec_delay(10);
 
-	*(volatile uint8_t *)(bios + 0x5555) = 0xAA;
+	chip_writeb(0xAA, bios + 0x5555);
 	myusec_delay(10);
-	*(volatile uint8_t *)(bios + 0x2AAA) = 0x55;
-	myusec_delay(10);
-	*(volatile uint8_t *)(bios + block) = 0x50;
+	chip_writeb(0x55, bios + 0x2AAA);
 	myusec_delay(10);
+	chip_writeb(0x50, bios + block);
 
 	/* wait for Toggle bit ready         */
-	toggle_ready_jedec(bios);
-
-	return (0);
+	return toggle_ready_jedec(flash, bios, FLASH_OP_BLOCK_ERASE);
 }
 
 int erase_chip_jedec(struct flashchip *flash)
@@ -116,140 +230,147 @@ int erase_chip_jedec(struct flashchip *flash)
 	volatile uint8_t *bios = flash->virtual_memory;
 
 	/*  Issue the JEDEC Chip Erase command   */
-	*(volatile uint8_t *)(bios + 0x5555) = 0xAA;
+	chip_writeb(0xAA, bios + 0x5555);
 	myusec_delay(10);
-	*(volatile uint8_t *)(bios + 0x2AAA) = 0x55;
+	chip_writeb(0x55, bios + 0x2AAA);
 	myusec_delay(10);
-	*(volatile uint8_t *)(bios + 0x5555) = 0x80;
+	chip_writeb(0x80, bios + 0x5555);
 	myusec_delay(10);
 
-	*(volatile uint8_t *)(bios + 0x5555) = 0xAA;
-	myusec_delay(10);
-	*(volatile uint8_t *)(bios + 0x2AAA) = 0x55;
+	chip_writeb(0xAA, bios + 0x5555);
 	myusec_delay(10);
-	*(volatile uint8_t *)(bios + 0x5555) = 0x10;
+	chip_writeb(0x55, bios + 0x2AAA);
 	myusec_delay(10);
+	chip_writeb(0x10, bios + 0x5555);
 
-	toggle_ready_jedec(bios);
-
-	return (0);
+	return toggle_ready_jedec(flash, bios, FLASH_OP_CHIP_ERASE);
 }
 
-int write_page_write_jedec(volatile uint8_t *bios, uint8_t *src,
-			   volatile uint8_t *dst, int page_size)
+/*
+ * Issue one page write. The chip programs the loaded bytes in a single
+ * internal cycle of several milliseconds; on FEATURE_PAGE_WRITE parts
+ * every byte that is not loaded reads back as 0xFF afterwards, so 0xFF
+ * need not be loaded. At least one byte is, to start the cycle.
+ */
+static int page_write_jedec(struct flashchip *flash, uint8_t *src,
+			    volatile uint8_t *dst, unsigned int page_size)
 {
-	int i, tried = 0, start_index = 0, ok;
-	volatile uint8_t *d = dst;
-	uint8_t *s = src;
+	volatile uint8_t *bios = flash->virtual_memory;
+	volatile uint8_t *last = NULL;
+	unsigned int i;
 
-retry:
 	/* Issue JEDEC Data Unprotect comand */
-	*(volatile uint8_t *)(bios + 0x5555) = 0xAA;
-	*(volatile uint8_t *)(bios + 0x2AAA) = 0x55;
-	*(volatile uint8_t *)(bios + 0x5555) = 0xA0;
+	chip_writeb(0xAA, bios + 0x5555);
+	chip_writeb(0x55, bios + 0x2AAA);
+	chip_writeb(0xA0, bios + 0x5555);
 
 	/* transfer data from source to destination */
-	for (i = start_index; i < page_size; i++) {
-		/* If the data is 0xFF, don't program it */
-		if (*src != 0xFF)
-			*dst = *src;
-		dst++;
-		src++;
+	for (i = 0; i < page_size; i++) {
+		if (src[i] == 0xFF && (last != NULL || i < page_size - 1))
+			continue;
+		chip_writeb(src[i], dst + i);
+		last = dst + i;
 	}
 
-	toggle_ready_jedec(dst - 1);
+	return toggle_ready_jedec(flash, last, FLASH_OP_PROGRAM);
+}
 
-	dst = d;
-	src = s;
-	ok = 1;
-	for (i = 0; i < page_size; i++) {
-		if (*dst != *src) {
-			ok = 0;
+/*
+ * The write engine only hands over pages that differ from the image. A
+ * page that fails to verify is loaded again as a whole, as a partial
+ * load would leave the bytes before it blank.
+ */
+int write_page_write_jedec(struct flashchip *flash, uint8_t *src,
+			   volatile uint8_t *dst, unsigned int page_size)
+{
+	volatile uint8_t *bios = flash->virtual_memory;
+	unsigned int i;
+	int tried;
+
+	for (tried = 0; tried < MAX_REFLASH_TRIES; tried++) {
+		if (page_write_jedec(flash, src, dst, page_size))
 			break;
-		}
-		dst++;
-		src++;
-	}
 
-	if (!ok && tried++ < MAX_REFLASH_TRIES) {
-		start_index = i;
-		goto retry;
-	}
-	if (!ok) {
-		fprintf(stderr, " page %d failed!\n",
-			(unsigned int)(d - bios) / page_size);
+		for (i = 0; i < page_size; i++)
+			if (chip_readb(dst + i) != src[i])
+				break;
+		if (i == page_size)
+			return 0;
 	}
-	return (!ok);
+
+	fprintf(stderr, " page %d failed!\n",
+		(unsigned int)(dst - bios) / page_size);
+	return -1;
 }
 
-int write_byte_program_jedec(volatile uint8_t *bios, uint8_t *src,
+/* Returns 0 once DQ7 shows the true data, which the chip only does
+ * after the program completed, or -1 if it does not finish in time.
+ */
+int write_byte_program_jedec(struct flashchip *flash, uint8_t *src,
 			     volatile uint8_t *dst)
 {
-	int tried = 0, ok = 1;
-
-	/* If the data is 0xFF, don't program it */
-	if (*src == 0xFF) {
-		return -1;
-	}
+	volatile uint8_t *bios = flash->virtual_memory;
 
-retry:
 	/* Issue JEDEC Byte Program command */
-	*(volatile uint8_t *)(bios + 0x5555) = 0xAA;
-	*(volatile uint8_t *)(bios + 0x2AAA) = 0x55;
-	*(volatile uint8_t *)(bios + 0x5555) = 0xA0;
+	chip_writeb(0xAA, bios + 0x5555);
+	chip_writeb(0x55, bios + 0x2AAA);
+	chip_writeb(0xA0, bios + 0x5555);
 
 	/* transfer data from source to destination */
-	*dst = *src;
-	toggle_ready_jedec(bios);
-
-	if (*dst != *src && tried++ < MAX_REFLASH_TRIES) {
-		goto retry;
+	chip_writeb(*src, dst);
+	if (data_polling_jedec(flash, dst, *src, FLASH_OP_PROGRAM)) {
+		printf("byte program FAILED at address=0x%08lx\n",
+		       (unsigned long)(dst - bios));
+		return -1;
 	}
 
-	if (tried >= MAX_REFLASH_TRIES)
-		ok = 0;
-
-	return (!ok);
+	return 0;
 }
 
-int write_sector_jedec(volatile uint8_t *bios, uint8_t *src,
-		       volatile uint8_t *dst, unsigned int page_size)
+/* old is the sector as the chip holds it; matching bytes are skipped */
+int write_sector_jedec(struct flashchip *flash, uint8_t *src,
+		       const uint8_t *old, volatile uint8_t *dst,
+		       unsigned int page_size)
 {
 	int i;
 
 	for (i = 0; i < page_size; i++) {
-		write_byte_program_jedec(bios, src, dst);
-		dst++, src++;
+		if (old[i] != src[i] &&
+		    write_byte_program_jedec(flash, src + i, dst + i))
+			return -1;
 	}
 
-	return (0);
+	return 0;
 }
 
-int write_jedec(struct flashchip *flash, uint8_t *buf)
+int program_block_jedec(struct flashchip *flash, uint8_t *src,
+			const uint8_t *old, unsigned int offset,
+			unsigned int size)
 {
-	int i;
-	int total_size = flash->total_size * 1024;
-	int page_size = flash->page_size;
 	volatile uint8_t *bios = flash->virtual_memory;
 
-	erase_chip_jedec(flash);
-	// dumb check if erase was successful.
-	for (i = 0; i < total_size; i++) {
-		if (bios[i] != (uint8_t) 0xff) {
-			printf("ERASE FAILED\n");
-			return -1;
-		}
-	}
+	return write_sector_jedec(flash, src, old, bios + offset, size);
+}
 
-	printf("Programming Page: ");
-	for (i = 0; i < total_size / page_size; i++) {
-		printf("%04d at address: 0x%08x", i, i * page_size);
-		write_page_write_jedec(bios, buf + i * page_size,
-				       bios + i * page_size, page_size);
-		printf("\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
-	}
-	printf("\n");
-	protect_jedec(bios);
+static int write_page_jedec_block(struct flashchip *flash, uint8_t *src,
+				  const uint8_t *old, unsigned int offset,
+				  unsigned int size)
+{
+	volatile uint8_t *bios = flash->virtual_memory;
+
+	return write_page_write_jedec(flash, src, bios + offset, size);
+}
+
+int write_jedec(struct flashchip *flash, uint8_t *buf)
+{
+	int ret;
+
+	/* These parts are only ever chip-erased, so let the write engine
+	 * decide whether an erase is needed at all.
+	 */
+	ret = write_flash_blocks(flash, buf, flash->page_size, NULL,
+				 write_page_jedec_block);
+	protect_jedec(flash->virtual_memory);
 
-	return (0);
+	return ret;
 }
@@ -3,67 +3,67 @@
 
 #include "udelay.h"
 
-int write_byte_program_jedec(volatile uint8_t *bios, uint8_t *src,
-			     volatile uint8_t *dst);
+extern void flash_op_timing(struct flashchip *flash, enum flash_op op,
+			    unsigned long *typ, unsigned long *max);
+extern int toggle_ready_jedec(struct flashchip *flash, volatile uint8_t *dst,
+			      enum flash_op op);
+extern int data_polling_jedec(struct flashchip *flash, volatile uint8_t *dst,
+			      uint8_t data, enum flash_op op);
 
 extern int probe_jedec(struct flashchip *flash);
 extern int erase_chip_jedec(struct flashchip *flash);
 extern int write_jedec(struct flashchip *flash, uint8_t *buf);
-extern int erase_sector_jedec(volatile uint8_t *bios, unsigned int page);
-extern int erase_block_jedec(volatile uint8_t *bios, unsigned int page);
-extern int write_sector_jedec(volatile uint8_t *bios, uint8_t *src,
-			      volatile uint8_t *dst, unsigned int page_size);
+extern int erase_sector_jedec(struct flashchip *flash, unsigned int page);
+extern int erase_block_jedec(struct flashchip *flash, unsigned int block);
+extern int write_byte_program_jedec(struct flashchip *flash, uint8_t *src,
+				    volatile uint8_t *dst);
+extern int write_sector_jedec(struct flashchip *flash, uint8_t *src,
+			      const uint8_t *old, volatile uint8_t *dst,
+			      unsigned int page_size);
+extern int write_page_write_jedec(struct flashchip *flash, uint8_t *src,
+				  volatile uint8_t *dst, unsigned int page_size);
+extern int program_block_jedec(struct flashchip *flash, uint8_t *src,
+			       const uint8_t *old, unsigned int offset,
+			       unsigned int size);
 
-extern __inline__ void toggle_ready_jedec(volatile uint8_t *dst)
+static __inline__ void unprotect_jedec(volatile uint8_t *bios)
 {
-	unsigned int i = 0;
-	uint8_t tmp1, tmp2;
+	chip_writeb(0xAA, bios + 0x5555);
+	chip_writeb(0x55, bios + 0x2AAA);
+	chip_writeb(0x80, bios + 0x5555);
+	chip_writeb(0xAA, bios + 0x5555);
+	chip_writeb(0x55, bios + 0x2AAA);
+	chip_writeb(0x20, bios + 0x5555);
 
-	tmp1 = *dst & 0x40;
-
-	while (i++ < 0xFFFFFFF) {
-		tmp2 = *dst & 0x40;
-		if (tmp1 == tmp2) {
-			break;
-		}
-		tmp1 = tmp2;
-	}
+	myusec_delay(200);
 }
 
-extern __inline__ void data_polling_jedec(volatile uint8_t *dst, uint8_t data)
+static __inline__ void protect_jedec(volatile uint8_t *bios)
 {
-	unsigned int i = 0;
-	uint8_t tmp;
+	chip_writeb(0xAA, bios + 0x5555);
+	chip_writeb(0x55, bios + 0x2AAA);
+	chip_writeb(0xA0, bios + 0x5555);
 
-	data &= 0x80;
-
-	while (i++ < 0xFFFFFFF) {
-		tmp = *dst & 0x80;
-		if (tmp == data) {
-			break;
-		}
-	}
+	myusec_delay(200);
 }
 
-extern __inline__ void unprotect_jedec(volatile uint8_t *bios)
+/*
+ * Unlock bypass, for chips with FEATURE_UNLOCK_BYPASS: once AA 55 20 is
+ * written, a byte program is just A0 and the data, two bus cycles
+ * instead of four. Nothing but programs and the 90 00 exit is accepted
+ * until the chip is taken out of the mode again.
+ */
+static __inline__ void enter_unlock_bypass(volatile uint8_t *bios)
 {
-	*(volatile uint8_t *)(bios + 0x5555) = 0xAA;
-	*(volatile uint8_t *)(bios + 0x2AAA) = 0x55;
-	*(volatile uint8_t *)(bios + 0x5555) = 0x80;
-	*(volatile uint8_t *)(bios + 0x5555) = 0xAA;
-	*(volatile uint8_t *)(bios + 0x2AAA) = 0x55;
-	*(volatile uint8_t *)(bios + 0x5555) = 0x20;
-
-	myusec_delay(200);
+	chip_writeb(0xAA, bios + 0x555);
+	chip_writeb(0x55, bios + 0x2AA);
+	chip_writeb(0x20, bios + 0x555);
 }
 
-extern __inline__ void protect_jedec(volatile uint8_t *bios)
+static __inline__ void exit_unlock_bypass(volatile uint8_t *bios)
 {
-	*(volatile uint8_t *)(bios + 0x5555) = 0xAA;
-	*(volatile uint8_t *)(bios + 0x2AAA) = 0x55;
-	*(volatile uint8_t *)(bios + 0x5555) = 0xA0;
-
-	myusec_delay(200);
+	chip_writeb(0x90, bios);
+	chip_writeb(0x00, bios);
 }
 
 #endif				/* !__JEDEC_H__ */
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include "flash.h"
 #include "layout.h"
 #include "lbtable.h"
 #include "debug.h"
@@ -16,16 +17,20 @@ int romimages = 0;
 
 extern int force;
 
-#define MAX_ROMLAYOUT	16
-
-typedef struct {
+/*
+ * Layout entries live in a growable array. Entries may nest or overlap;
+ * what gets written is decided on merged intervals, see
+ * layout_keep_ranges().
+ */
+struct romentry {
 	unsigned int start;
-	unsigned int end;
+	unsigned int end;	/* inclusive */
 	unsigned int included;
-	char name[256];
-} romlayout_t;
+	char *name;
+};
 
-romlayout_t rom_entries[MAX_ROMLAYOUT];
+static struct romentry *rom_entries = NULL;
+static int rom_entries_alloc = 0;
 
 static char *def_name = "DEFAULT";
 
@@ -104,11 +109,49 @@ int show_id(uint8_t *bios, int size)
 	return 0;
 }
 
+#define LAYOUT_LINE	1024
+
+static int add_romentry(unsigned int start, unsigned int end,
+			const char *name)
+{
+	struct romentry *e;
+
+	if (romimages == rom_entries_alloc) {
+		rom_entries_alloc = rom_entries_alloc ? rom_entries_alloc * 2 : 32;
+		e = (struct romentry *) realloc(rom_entries, rom_entries_alloc *
+						sizeof(*e));
+		if (e == NULL) {
+			fprintf(stderr, "ERROR: Out of memory for the rom "
+				"layout.\n");
+			return -1;
+		}
+		rom_entries = e;
+	}
+
+	e = &rom_entries[romimages];
+	e->start = start;
+	e->end = end;
+	e->included = 0;
+	if ((e->name = strdup(name)) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory for the rom layout.\n");
+		return -1;
+	}
+	romimages++;
+
+	return 0;
+}
+
+/*
+ * Each line is "start:end name" with hexadecimal, inclusive bounds.
+ * Blank lines and lines starting with # are skipped.
+ */
 int read_romlayout(char *name)
 {
 	FILE *romlayout;
-	char tempstr[256];
-	int i;
+	char line[LAYOUT_LINE], range[LAYOUT_LINE], entry[LAYOUT_LINE];
+	char *tstr1, *tstr2, *p;
+	unsigned int start, end;
+	int i, lineno = 0;
 
 	romlayout = fopen(name, "r");
 
@@ -118,22 +161,32 @@ int read_romlayout(char *name)
 		return -1;
 	}
 
-	while (!feof(romlayout)) {
-		char *tstr1, *tstr2;
-		fscanf(romlayout, "%s %s\n", tempstr,
-		       rom_entries[romimages].name);
-#if 0
-		// fscanf does not like arbitrary comments like that :( later
-		if (tempstr[0] == '#') {
+	while (fgets(line, sizeof(line), romlayout) != NULL) {
+		lineno++;
+		for (p = line; *p == ' ' || *p == '\t'; p++) ;
+		if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0')
 			continue;
+
+		if (sscanf(p, "%s %s", range, entry) != 2 ||
+		    (tstr1 = strtok(range, ":")) == NULL ||
+		    (tstr2 = strtok(NULL, ":")) == NULL) {
+			fprintf(stderr, "ERROR: %s:%d: expected "
+				"\"start:end name\".\n", name, lineno);
+			fclose(romlayout);
+			return -1;
+		}
+		start = strtoul(tstr1, (char **)NULL, 16);
+		end = strtoul(tstr2, (char **)NULL, 16);
+		if (end < start) {
+			fprintf(stderr, "ERROR: %s:%d: region %s ends before "
+				"it starts.\n", name, lineno, entry);
+			fclose(romlayout);
+			return -1;
+		}
+		if (add_romentry(start, end, entry)) {
+			fclose(romlayout);
+			return -1;
 		}
-#endif
-		tstr1 = strtok(tempstr, ":");
-		tstr2 = strtok(NULL, ":");
-		rom_entries[romimages].start = strtol(tstr1, (char **)NULL, 16);
-		rom_entries[romimages].end = strtol(tstr2, (char **)NULL, 16);
-		rom_entries[romimages].included = 0;
-		romimages++;
 	}
 
 	for (i = 0; i < romimages; i++) {
@@ -146,9 +199,10 @@ int read_romlayout(char *name)
 	return 0;
 }
 
+/* Include every region called name; nested layouts may reuse names */
 int find_romentry(char *name)
 {
-	int i;
+	int i, found = -1;
 
 	if (!romimages)
 		return -1;
@@ -158,42 +212,154 @@ int find_romentry(char *name)
 	for (i = 0; i < romimages; i++) {
 		if (!strcmp(rom_entries[i].name, name)) {
 			rom_entries[i].included = 1;
-			printf("found.\n");
-			return i;
+			if (found < 0)
+				found = i;
 		}
 	}
+	if (found >= 0) {
+		printf("found.\n");
+		return found;
+	}
 	printf("not found.\n");
 	// Not found. Error.
 	return -1;
 }
 
-int handle_romentries(uint8_t *buffer, uint8_t *content)
+static int compare_ranges(const void *a, const void *b)
 {
-	int i;
+	const struct layout_range *x = a, *y = b;
+
+	if (x->start != y->start)
+		return x->start < y->start ? -1 : 1;
+	return 0;
+}
 
-	// This function does not safe flash write cycles.
-	// 
-	// Also it does not cope with overlapping rom layout
-	// sections. 
-	// example:
-	// 00000000:00008fff gfxrom
-	// 00009000:0003ffff normal
-	// 00040000:0007ffff fallback
-	// 00000000:0007ffff all
-	//
-	// If you'd specify -i all the included flag of all other
-	// sections is still 0, so no changes will be made to the
-	// flash. Same thing if you specify -i normal -i all only 
-	// normal will be updated and the rest will be kept.
+/*
+ * Collect the entries with the given included flag into out, sorted and
+ * merged into disjoint ranges. Touching ranges are merged as well.
+ * Returns the number of ranges.
+ */
+static int merge_entries(unsigned int included, struct layout_range *out)
+{
+	int i, count = 0, n;
 
 	for (i = 0; i < romimages; i++) {
+		if (rom_entries[i].included != included)
+			continue;
+		out[count].start = rom_entries[i].start;
+		out[count].end = rom_entries[i].end;
+		count++;
+	}
+	if (count <= 1)
+		return count;
+
+	qsort(out, count, sizeof(*out), compare_ranges);
+	for (i = 1, n = 0; i < count; i++) {
+		if (out[n].end == 0xffffffff || out[i].start <= out[n].end + 1) {
+			if (out[i].end > out[n].end)
+				out[n].end = out[i].end;
+			continue;
+		}
+		out[++n] = out[i];
+	}
+
+	return n + 1;
+}
+
+/*
+ * Work out which bytes of the chip have to keep their current contents:
+ * everything covered by a region that was not selected with -i, unless a
+ * selected region covers it too. Nested and overlapping regions are
+ * fine, e.g. with
+ *
+ *	00000000:0007ffff all
+ *	00000000:00008fff gfxrom
+ *	00040000:0007ffff fallback
+ *
+ * "-i all" replaces the whole chip and "-i gfxrom" only the first 36K.
+ * Bytes outside every region are always taken from the image.
+ *
+ * The result is sorted and disjoint, and the caller frees it. Returns the
+ * number of ranges, or -1 if out of memory.
+ */
+int layout_keep_ranges(struct layout_range **ranges)
+{
+	struct layout_range *incl, *excl, *keep;
+	int nincl, nexcl, nkeep = 0, i, j = 0;
+	unsigned int cur;
+
+	*ranges = NULL;
+	if (!romimages)
+		return 0;
 
-		if (rom_entries[i].included)
+	incl = (struct layout_range *) malloc(romimages * sizeof(*incl));
+	excl = (struct layout_range *) malloc(romimages * sizeof(*excl));
+	/* each selected range adds at most one kept range by splitting one */
+	keep = (struct layout_range *) malloc(romimages * sizeof(*keep));
+	if (incl == NULL || excl == NULL || keep == NULL) {
+		fprintf(stderr, "ERROR: Out of memory for the rom layout.\n");
+		free(incl);
+		free(excl);
+		free(keep);
+		return -1;
+	}
+
+	nincl = merge_entries(1, incl);
+	nexcl = merge_entries(0, excl);
+
+	/* both lists are sorted, so one pass subtracts incl from excl */
+	for (i = 0; i < nexcl; i++) {
+		cur = excl[i].start;
+		while (j < nincl && incl[j].end < cur)
+			j++;
+		while (j < nincl && incl[j].start <= excl[i].end) {
+			if (incl[j].start > cur) {
+				keep[nkeep].start = cur;
+				keep[nkeep].end = incl[j].start - 1;
+				nkeep++;
+			}
+			if (incl[j].end >= excl[i].end)
+				break;
+			cur = incl[j].end + 1;
+			j++;
+		}
+		if (j < nincl && incl[j].start <= excl[i].end &&
+		    incl[j].end >= excl[i].end)
 			continue;
+		keep[nkeep].start = cur;
+		keep[nkeep].end = excl[i].end;
+		nkeep++;
+	}
+
+	free(incl);
+	free(excl);
+	if (nkeep == 0)
+		free(keep);
+	else
+		*ranges = keep;
+
+	return nkeep;
+}
+
+/*
+ * Copy the current chip contents into buffer over the ranges returned by
+ * layout_keep_ranges(), so writing buffer leaves those bytes as they are.
+ * Ranges reaching past the end of the chip are clipped to size.
+ */
+int handle_romentries(uint8_t *buffer, volatile uint8_t *content,
+		      unsigned long size, const struct layout_range *keep,
+		      int nkeep)
+{
+	unsigned int end;
+	int i;
 
-		memcpy(buffer + rom_entries[i].start,
-		       content + rom_entries[i].start,
-		       rom_entries[i].end - rom_entries[i].start);
+	for (i = 0; i < nkeep; i++) {
+		if (keep[i].start >= size)
+			break;
+		end = keep[i].end < size ? keep[i].end : size - 1;
+		printf_debug("Keeping %08x - %08x\n", keep[i].start, end);
+		chip_readn(buffer + keep[i].start, content + keep[i].start,
+			   end - keep[i].start + 1);
 	}
 
 	return 0;
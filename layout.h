@@ -1,9 +1,17 @@
 #ifndef __LAYOUT_H__
 #define __LAYOUT_H__ 1
 
+struct layout_range {
+	unsigned int start;
+	unsigned int end;	/* inclusive */
+};
+
 int show_id(uint8_t *bios, int size);
 int read_romlayout(char *name);
 int find_romentry(char *name);
-int handle_romentries(uint8_t *buffer, uint8_t *content);
+int layout_keep_ranges(struct layout_range **ranges);
+int handle_romentries(uint8_t *buffer, volatile uint8_t *content,
+		      unsigned long size, const struct layout_range *keep,
+		      int nkeep);
 
 #endif				/* !__LAYOUT_H__ */
@@ -23,8 +23,13 @@
  *
  */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "flash.h"
+#include "jedec.h"
 #include "m29f400bt.h"
+#include "writeplan.h"
 #include "debug.h"
 
 int probe_m29f400bt(struct flashchip *flash)
@@ -32,20 +37,24 @@ int probe_m29f400bt(struct flashchip *flash)
 	volatile uint8_t *bios = flash->virtual_memory;
 	uint8_t id1, id2;
 
-	*(volatile uint8_t *)(bios + 0xAAA) = 0xAA;
-	*(volatile uint8_t *)(bios + 0x555) = 0x55;
-	*(volatile uint8_t *)(bios + 0xAAA) = 0x90;
+	if (!probe_id_cached(probe_m29f400bt, bios, &id1, &id2)) {
+		chip_writeb(0xAA, bios + 0xAAA);
+		chip_writeb(0x55, bios + 0x555);
+		chip_writeb(0x90, bios + 0xAAA);
 
-	myusec_delay(10);
+		myusec_delay(10);
 
-	id1 = *(volatile uint8_t *)bios;
-	id2 = *(volatile uint8_t *)(bios + 0x02);
+		id1 = chip_readb(bios);
+		id2 = chip_readb(bios + 0x02);
 
-	*(volatile uint8_t *)(bios + 0xAAA) = 0xAA;
-	*(volatile uint8_t *)(bios + 0x555) = 0x55;
-	*(volatile uint8_t *)(bios + 0xAAA) = 0xF0;
+		chip_writeb(0xAA, bios + 0xAAA);
+		chip_writeb(0x55, bios + 0x555);
+		chip_writeb(0xF0, bios + 0xAAA);
 
-	myusec_delay(10);
+		myusec_delay(10);
+
+		probe_id_store(probe_m29f400bt, bios, id1, id2);
+	}
 
 	printf_debug("%s: id1 0x%x, id2 0x%x\n", __FUNCTION__, id1, id2);
 
@@ -59,131 +68,112 @@ int erase_m29f400bt(struct flashchip *flash)
 {
 	volatile uint8_t *bios = flash->virtual_memory;
 
-	*(volatile uint8_t *)(bios + 0xAAA) = 0xAA;
-	*(volatile uint8_t *)(bios + 0x555) = 0x55;
-	*(volatile uint8_t *)(bios + 0xAAA) = 0x80;
+	chip_writeb(0xAA, bios + 0xAAA);
+	chip_writeb(0x55, bios + 0x555);
+	chip_writeb(0x80, bios + 0xAAA);
 
-	*(volatile uint8_t *)(bios + 0xAAA) = 0xAA;
-	*(volatile uint8_t *)(bios + 0x555) = 0x55;
-	*(volatile uint8_t *)(bios + 0xAAA) = 0x10;
+	chip_writeb(0xAA, bios + 0xAAA);
+	chip_writeb(0x55, bios + 0x555);
+	chip_writeb(0x10, bios + 0xAAA);
 
 	myusec_delay(10);
-	toggle_ready_m29f400bt(bios);
-
-	return (0);
+	return toggle_ready_jedec(flash, bios, FLASH_OP_CHIP_ERASE);
 }
 
-int block_erase_m29f400bt(volatile uint8_t *bios, volatile uint8_t *dst)
+int block_erase_m29f400bt(struct flashchip *flash, volatile uint8_t *dst)
 {
+	volatile uint8_t *bios = flash->virtual_memory;
 
-	*(volatile uint8_t *)(bios + 0xAAA) = 0xAA;
-	*(volatile uint8_t *)(bios + 0x555) = 0x55;
-	*(volatile uint8_t *)(bios + 0xAAA) = 0x80;
+	chip_writeb(0xAA, bios + 0xAAA);
+	chip_writeb(0x55, bios + 0x555);
+	chip_writeb(0x80, bios + 0xAAA);
 
-	*(volatile uint8_t *)(bios + 0xAAA) = 0xAA;
-	*(volatile uint8_t *)(bios + 0x555) = 0x55;
+	chip_writeb(0xAA, bios + 0xAAA);
+	chip_writeb(0x55, bios + 0x555);
 	//*(volatile uint8_t *) (bios + 0xAAA) = 0x10;
-	*dst = 0x30;
+	chip_writeb(0x30, dst);
 
 	myusec_delay(10);
-	toggle_ready_m29f400bt(bios);
+	/* the status comes from the bank that is erasing */
+	return toggle_ready_jedec(flash, dst, FLASH_OP_BLOCK_ERASE);
+}
 
-	return (0);
+static int erase_block_m29f400bt(struct flashchip *flash, unsigned int offset,
+				 unsigned int size)
+{
+	return block_erase_m29f400bt(flash, flash->virtual_memory + offset);
 }
 
-int write_m29f400bt(struct flashchip *flash, uint8_t *buf)
+/* Program the bytes that differ, waiting for each on DQ7 */
+static int program_block_m29f400bt(struct flashchip *flash, uint8_t *src,
+				   const uint8_t *old, unsigned int offset,
+				   unsigned int size)
 {
-	int i;
-	int total_size = flash->total_size * 1024;
-	int page_size = flash->page_size;
 	volatile uint8_t *bios = flash->virtual_memory;
-
-	//erase_m29f400bt (flash);
-	printf("Programming Page:\n ");
-	/*********************************
-	*Pages for M29F400BT:
-	* 16	0x7c000		0x7ffff		TOP
-	*  8 	0x7a000		0x7bfff
-	*  8 	0x78000		0x79fff
-	* 32	0x70000		0x77fff
-	* 64	0x60000		0x6ffff
-	* 64	0x50000		0x5ffff
-	* 64	0x40000		0x4ffff
-	*---------------------------------
-	* 64	0x30000		0x3ffff
-	* 64	0x20000		0x2ffff
-	* 64	0x10000		0x1ffff
-	* 64	0x00000		0x0ffff		BOTTOM
-	*********************************/
-	printf("total_size/page_size = %d\n", total_size / page_size);
-	for (i = 0; i < (total_size / page_size) - 1; i++) {
-		printf("%04d at address: 0x%08x\n", i, i * page_size);
-		block_erase_m29f400bt(bios, bios + i * page_size);
-		write_page_m29f400bt(bios, buf + i * page_size,
-				     bios + i * page_size, page_size);
-		printf("\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
+	volatile uint8_t *dst = bios + offset;
+	unsigned int i;
+
+	for (i = 0; i < size; i++, src++, dst++) {
+		/* Skip bytes that already match */
+		if (old[i] == *src)
+			continue;
+
+		chip_writeb(0xAA, bios + 0xAAA);
+		chip_writeb(0x55, bios + 0x555);
+		chip_writeb(0xA0, bios + 0xAAA);
+		chip_writeb(*src, dst);
+
+		/* DQ7 only shows the true data once the program is done */
+		if (data_polling_jedec(flash, dst, *src, FLASH_OP_PROGRAM)) {
+			printf("byte program FAILED at address=0x%08lx\n",
+			       (unsigned long)(dst - bios));
+			chip_writeb(0xF0, bios);
+			return -1;
+		}
 	}
 
-	printf("%04d at address: 0x%08x\n", 7, 0x70000);
-	block_erase_m29f400bt(bios, bios + 0x70000);
-	write_page_m29f400bt(bios, buf + 0x70000, bios + 0x70000, 32 * 1024);
-
-	printf("%04d at address: 0x%08x\n", 8, 0x78000);
-	block_erase_m29f400bt(bios, bios + 0x78000);
-	write_page_m29f400bt(bios, buf + 0x78000, bios + 0x78000, 8 * 1024);
-
-	printf("%04d at address: 0x%08x\n", 9, 0x7a000);
-	block_erase_m29f400bt(bios, bios + 0x7a000);
-	write_page_m29f400bt(bios, buf + 0x7a000, bios + 0x7a000, 8 * 1024);
-
-	printf("%04d at address: 0x%08x\n", 10, 0x7c000);
-	block_erase_m29f400bt(bios, bios + 0x7c000);
-	write_page_m29f400bt(bios, buf + 0x7c000, bios + 0x7c000, 16 * 1024);
-
-	printf("\n");
-	//protect_m29f400bt (bios);
+	return 0;
+}
 
-	return (0);
+/*
+ * The blocks come from the chip's boot block geometry, and the write
+ * engine leaves out the ones that already match the image.
+ */
+int write_m29f400bt(struct flashchip *flash, uint8_t *buf)
+{
+	return write_flash_geometry(flash, buf, 0x30, erase_block_m29f400bt,
+				    program_block_m29f400bt);
 }
 
+/*
+ * LinuxBIOS only lives in the bottom four 64K blocks. The rest is masked
+ * on a copy of the write mask, so the chip's own mask (from -s/-e and
+ * the layout) is back in place when this returns.
+ */
 int write_linuxbios_m29f400bt(struct flashchip *flash, uint8_t *buf)
 {
-	volatile uint8_t *bios = flash->virtual_memory;
+	unsigned int npages = flash->total_size * 1024 / flash->page_size;
+	uint8_t *saved = flash->write_mask;
+	int ret;
+
+	if (saved != NULL) {
+		flash->write_mask = (uint8_t *) malloc((npages + 7) / 8);
+		if (flash->write_mask == NULL) {
+			fprintf(stderr, "Error: Out of memory for the "
+				"write mask\n");
+			flash->write_mask = saved;
+			return -1;
+		}
+		memcpy(flash->write_mask, saved, (npages + 7) / 8);
+	}
+
+	if (write_mask_exclude(flash, 0x40000, flash->total_size * 1024) < 0)
+		ret = -1;
+	else
+		ret = write_m29f400bt(flash, buf);
+
+	free(flash->write_mask);
+	flash->write_mask = saved;
 
-	printf("Programming Page:\n ");
-	/*********************************
-	*Pages for M29F400BT:
-	* 16	0x7c000		0x7ffff		TOP
-	*  8 	0x7a000		0x7bfff
-	*  8 	0x78000		0x79fff
-	* 32	0x70000		0x77fff
-	* 64	0x60000		0x6ffff
-	* 64	0x50000		0x5ffff
-	* 64	0x40000		0x4ffff
-	*---------------------------------
-	* 64	0x30000		0x3ffff
-	* 64	0x20000		0x2ffff
-	* 64	0x10000		0x1ffff
-	* 64	0x00000		0x0ffff		BOTTOM
-	*********************************/
-	printf("%04d at address: 0x%08x\n", 7, 0x00000);
-	block_erase_m29f400bt(bios, bios + 0x00000);
-	write_page_m29f400bt(bios, buf + 0x00000, bios + 0x00000, 64 * 1024);
-
-	printf("%04d at address: 0x%08x\n", 7, 0x10000);
-	block_erase_m29f400bt(bios, bios + 0x10000);
-	write_page_m29f400bt(bios, buf + 0x10000, bios + 0x10000, 64 * 1024);
-
-	printf("%04d at address: 0x%08x\n", 7, 0x20000);
-	block_erase_m29f400bt(bios, bios + 0x20000);
-	write_page_m29f400bt(bios, buf + 0x20000, bios + 0x20000, 64 * 1024);
-
-	printf("%04d at address: 0x%08x\n", 7, 0x30000);
-	block_erase_m29f400bt(bios, bios + 0x30000);
-	write_page_m29f400bt(bios, buf + 0x30000, bios + 0x30000, 64 * 1024);
-
-	printf("\n");
-	//protect_m29f400bt (bios);
-
-	return (0);
+	return ret;
 }
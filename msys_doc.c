@@ -152,13 +152,13 @@ int erase_md2802(struct flashchip *flash)
 	volatile uint8_t *bios = flash->virtual_memory;
 
 	return (1);
-	*(volatile uint8_t *)(bios + 0x5555) = 0xAA;
-	*(volatile uint8_t *)(bios + 0x2AAA) = 0x55;
-	*(volatile uint8_t *)(bios + 0x5555) = 0x80;
+	chip_writeb(0xAA, bios + 0x5555);
+	chip_writeb(0x55, bios + 0x2AAA);
+	chip_writeb(0x80, bios + 0x5555);
 
-	*(volatile uint8_t *)(bios + 0x5555) = 0xAA;
-	*(volatile uint8_t *)(bios + 0x2AAA) = 0x55;
-	*(volatile uint8_t *)(bios + 0x5555) = 0x10;
+	chip_writeb(0xAA, bios + 0x5555);
+	chip_writeb(0x55, bios + 0x2AAA);
+	chip_writeb(0x10, bios + 0x5555);
 }				/* int erase_md2802(struct flashchip *flash) */
 
 int write_md2802(struct flashchip *flash, uint8_t *buf)
@@ -170,7 +170,7 @@ int write_md2802(struct flashchip *flash, uint8_t *buf)
 
 	return (1);
 	erase_md2802(flash);
-	if (*bios != (uint8_t) 0xff) {
+	if (chip_readb(bios) != (uint8_t) 0xff) {
 		printf("ERASE FAILED\n");
 		return -1;
 	}
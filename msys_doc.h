@@ -63,7 +63,7 @@
 #define MSYSTEMS_DOC_W_CDSNIO_BASE                0x0800
 
 #define doc_read(base,reg) \
-	(*(volatile uint8_t *)(base + MSYSTEMS_DOC_R_##reg))
+	chip_readb((base) + MSYSTEMS_DOC_R_##reg)
 
 #define doc_read_nop(base) \
 	doc_read(base, NOP)
@@ -75,7 +75,7 @@
 	{ doc_read_2nop(base); doc_read_2nop(base); }
 
 #define doc_write(data,base,reg) \
-	(*(volatile uint8_t *)(base + MSYSTEMS_DOC_W_##reg)) = data
+	chip_writeb(data, (base) + MSYSTEMS_DOC_W_##reg)
 
 #define doc_write_nop(base) \
 	doc_write(0, base, NOP)
@@ -29,6 +29,7 @@
 #include "flash.h"
 #include "jedec.h"
 #include "mx29f002.h"
+#include "writeplan.h"
 #include "debug.h"
 
 int probe_29f002(struct flashchip *flash)
@@ -36,16 +37,20 @@ int probe_29f002(struct flashchip *flash)
 	volatile uint8_t *bios = flash->virtual_memory;
 	uint8_t id1, id2;
 
-	*(bios + 0x5555) = 0xAA;
-	*(bios + 0x2AAA) = 0x55;
-	*(bios + 0x5555) = 0x90;
+	if (!probe_id_cached(probe_29f002, bios, &id1, &id2)) {
+		chip_writeb(0xAA, bios + 0x5555);
+		chip_writeb(0x55, bios + 0x2AAA);
+		chip_writeb(0x90, bios + 0x5555);
 
-	id1 = *(volatile uint8_t *)bios;
-	id2 = *(volatile uint8_t *)(bios + 0x01);
+		id1 = chip_readb(bios);
+		id2 = chip_readb(bios + 0x01);
 
-	*bios = 0xF0;
+		chip_writeb(0xF0, bios);
 
-	myusec_delay(10);
+		myusec_delay(10);
+
+		probe_id_store(probe_29f002, bios, id1, id2);
+	}
 
 	printf_debug("%s: id1 0x%x, id2 0x%x\n", __FUNCTION__, id1, id2);
 	if (id1 == flash->manufacture_id && id2 == flash->model_id)
@@ -58,28 +63,29 @@ int erase_29f002(struct flashchip *flash)
 {
 	volatile uint8_t *bios = flash->virtual_memory;
 
-	*(bios + 0x555) = 0xF0;
-	*(bios + 0x555) = 0xAA;
-	*(bios + 0x2AA) = 0x55;
-	*(bios + 0x555) = 0x80;
-	*(bios + 0x555) = 0xAA;
-	*(bios + 0x2AA) = 0x55;
-	*(bios + 0x555) = 0x10;
+	chip_writeb(0xF0, bios + 0x555);
+	chip_writeb(0xAA, bios + 0x555);
+	chip_writeb(0x55, bios + 0x2AA);
+	chip_writeb(0x80, bios + 0x555);
+	chip_writeb(0xAA, bios + 0x555);
+	chip_writeb(0x55, bios + 0x2AA);
+	chip_writeb(0x10, bios + 0x555);
 
 	myusec_delay(100);
-	toggle_ready_jedec(bios);
+	if (toggle_ready_jedec(flash, bios, FLASH_OP_CHIP_ERASE))
+		return -1;
 
 	//   while ((*bios & 0x40) != 0x40)
 	//;
 
 #if 0
-	toggle_ready_jedec(bios);
-	*(bios + 0x0ffff) = 0x30;
-	*(bios + 0x1ffff) = 0x30;
-	*(bios + 0x2ffff) = 0x30;
-	*(bios + 0x37fff) = 0x30;
-	*(bios + 0x39fff) = 0x30;
-	*(bios + 0x3bfff) = 0x30;
+	toggle_ready_jedec(flash, bios, FLASH_OP_CHIP_ERASE);
+	chip_writeb(0x30, bios + 0x0ffff);
+	chip_writeb(0x30, bios + 0x1ffff);
+	chip_writeb(0x30, bios + 0x2ffff);
+	chip_writeb(0x30, bios + 0x37fff);
+	chip_writeb(0x30, bios + 0x39fff);
+	chip_writeb(0x30, bios + 0x3bfff);
 #endif
 
 	return (0);
@@ -87,34 +93,12 @@ int erase_29f002(struct flashchip *flash)
 
 int write_29f002(struct flashchip *flash, uint8_t *buf)
 {
-	int i;
-	int total_size = flash->total_size * 1024;
 	volatile uint8_t *bios = flash->virtual_memory;
-	volatile uint8_t *dst = bios;
 
-	*bios = 0xF0;
+	chip_writeb(0xF0, bios);
 	myusec_delay(10);
-	erase_29f002(flash);
-	//*bios = 0xF0;
-#if 1
-	printf("Programming Page: ");
-	for (i = 0; i < total_size; i++) {
-		/* write to the sector */
-		if ((i & 0xfff) == 0)
-			printf("address: 0x%08lx", (unsigned long)i);
-		*(bios + 0x5555) = 0xAA;
-		*(bios + 0x2AAA) = 0x55;
-		*(bios + 0x5555) = 0xA0;
-		*dst++ = *buf++;
-
-		/* wait for Toggle bit ready */
-		toggle_ready_jedec(dst);
-
-		if ((i & 0xfff) == 0)
-			printf("\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
-	}
-#endif
-	printf("\n");
 
-	return (0);
+	/* chip erase only, the engine decides whether it is needed */
+	return write_flash_blocks(flash, buf, flash->page_size, NULL,
+				  program_block_jedec);
 }
@@ -26,32 +26,16 @@
 #include "flash.h"
 #include "jedec.h"
 #include "pm49fl004.h"
+#include "writeplan.h"
 
-extern int exclude_start_page, exclude_end_page;
+static int erase_block_49fl004(struct flashchip *flash, unsigned int offset,
+			       unsigned int size)
+{
+	return erase_block_jedec(flash, offset);
+}
 
 int write_49fl004(struct flashchip *flash, uint8_t *buf)
 {
-	int i;
-	int total_size = flash->total_size * 1024;
-	int page_size = flash->page_size;
-	volatile uint8_t *bios = flash->virtual_memory;
-
-	printf("Programming Page: ");
-	for (i = 0; i < total_size / page_size; i++) {
-		if ((i >= exclude_start_page) && (i < exclude_end_page))
-			continue;
-
-		/* erase the page before programming */
-		erase_block_jedec(bios, i * page_size);
-
-		/* write to the sector */
-		printf("%04d at address: 0x%08x", i, i * page_size);
-		write_sector_jedec(bios, buf + i * page_size,
-				   bios + i * page_size, page_size);
-		printf("\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
-		fflush(stdout);
-	}
-	printf("\n");
-
-	return (0);
+	return write_flash_blocks(flash, buf, flash->page_size,
+				  erase_block_49fl004, program_block_jedec);
 }
@@ -0,0 +1,335 @@
+/*
+ * replay.c: replay a --trace file on the simulated chip
+ *
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *
+ * The recorded writes are fed to the chip model in order. The first
+ * gap_usec of the gap before each cycle is taken as the bus time of that
+ * cycle, which the model's access time replaces; anything beyond it is
+ * the driver's own delay and is replayed as such.
+ *
+ * Polling is where a recorded session depends on the chip it ran on, so
+ * reads that hit a busy chip are treated as a poll loop: once the model
+ * is ready the rest of the recorded loop is skipped, and if the recorded
+ * loop ends while the model is still busy, polling continues at the
+ * loop's average spacing. The result is the session's timing under the
+ * model's latencies, printed as JSON.
+ *
+ * With -e the final contents are compared against an image, which makes
+ * the replay a regression test. Port I/O cycles are counted, not replayed.
+ *
+ * usage: flashreplay [-O simoptions] [-c chip] [-e image] [-g usec] trace
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+
+#include "flash.h"
+#include "sim.h"
+#include "trace.h"
+
+#define DEFAULT_GAP_USEC	1
+#define MAX_EXTRA_POLLS		1000000
+#define MAX_REPORTED_MISMATCHES	8
+
+struct replay_window {
+	volatile uint8_t *virt;
+	uint64_t phys;
+	unsigned long len;
+};
+
+struct replay_stats {
+	unsigned long reads, writes, bulk_bytes;
+	unsigned long skipped_polls, extra_polls;
+	unsigned long port_cycles, unmapped, read_mismatches;
+	uint64_t recorded_us;
+};
+
+static struct replay_window windows[2];
+
+static volatile uint8_t *replay_addr(uint32_t address, unsigned long len)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (address < windows[i].phys ||
+		    address + (uint64_t)len > windows[i].phys + windows[i].len)
+			continue;
+		return windows[i].virt + (address - windows[i].phys);
+	}
+
+	return NULL;
+}
+
+static void usage(const char *name)
+{
+	printf("usage: %s [-O simoptions] [-c chip] [-e image] [-g usec] "
+	       "trace\n", name);
+	printf("   -O <options>: simulator options, e.g. image=old.bin,program=20\n"
+	       "   -c <chip>:    chip to simulate instead of the traced one\n"
+	       "   -e <image>:   fail unless the chip ends up holding image\n"
+	       "   -g <usec>:    bus time per traced cycle (default %d)\n",
+	       DEFAULT_GAP_USEC);
+	exit(1);
+}
+
+static int check_image(const char *filename, unsigned long size,
+		       unsigned long *differing)
+{
+	const uint8_t *contents = sim_contents();
+	unsigned long i;
+	uint8_t *buf;
+	FILE *f;
+
+	buf = (uint8_t *) malloc(size);
+	if (buf == NULL) {
+		fprintf(stderr, "Error: Out of memory for the image\n");
+		return -1;
+	}
+	if ((f = fopen(filename, "rb")) == NULL) {
+		perror(filename);
+		free(buf);
+		return -1;
+	}
+	if (fread(buf, 1, size, f) != size) {
+		fprintf(stderr, "Error: %s is not a %lu KB image\n",
+			filename, size / 1024);
+		fclose(f);
+		free(buf);
+		return -1;
+	}
+	fclose(f);
+
+	*differing = 0;
+	for (i = 0; i < size; i++)
+		if (contents[i] != buf[i])
+			(*differing)++;
+
+	free(buf);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct trace_header header;
+	struct trace_record r;
+	struct replay_stats st;
+	struct flashchip *flash;
+	volatile uint8_t *addr;
+	char *options = NULL, *chip = NULL, *expected = NULL;
+	char name[sizeof(header.chip) + 1], spec[256];
+	unsigned long size, i, differing = 0;
+	uint32_t prev_usec = 0, first_usec = 0, gap, gap_usec = DEFAULT_GAP_USEC;
+	uint32_t poll_address = 0, poll_start = 0, poll_last = 0;
+	unsigned long poll_reads = 0, j;
+	uint8_t val;
+	int opt, polling = 0, poll_done = 0, ret = 0;
+	uint64_t start_ns;
+	FILE *f;
+
+	while ((opt = getopt(argc, argv, "O:c:e:g:h")) != EOF) {
+		switch (opt) {
+		case 'O':
+			options = optarg;
+			break;
+		case 'c':
+			chip = optarg;
+			break;
+		case 'e':
+			expected = optarg;
+			break;
+		case 'g':
+			gap_usec = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			break;
+		}
+	}
+	if (optind != argc - 1)
+		usage(argv[0]);
+
+	if ((f = fopen(argv[optind], "rb")) == NULL) {
+		perror(argv[optind]);
+		exit(1);
+	}
+	if (fread(&header, sizeof(header), 1, f) != 1 ||
+	    memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) ||
+	    header.version != TRACE_VERSION ||
+	    header.record_size != sizeof(struct trace_record)) {
+		fprintf(stderr, "Error: %s is not a bus cycle trace\n",
+			argv[optind]);
+		exit(1);
+	}
+	memcpy(name, header.chip, sizeof(header.chip));
+	name[sizeof(header.chip)] = '\0';
+	if (chip == NULL)
+		chip = name;
+	if (*chip == '\0') {
+		fprintf(stderr, "Error: the trace names no chip, use -c\n");
+		exit(1);
+	}
+	if (header.lost)
+		fprintf(stderr, "Warning: the trace lost its first %lu cycles, "
+			"the replay starts mid-session\n",
+			(unsigned long)header.lost);
+
+	snprintf(spec, sizeof(spec), "%s%s%s", chip, options ? "," : "",
+		 options ? options : "");
+	if (sim_init(spec))
+		exit(1);
+
+	for (flash = flashchips; flash->name != NULL; flash++)
+		if (!strcmp(flash->name, sim_chip_name()))
+			break;
+	size = flash->total_size * 1024;
+	windows[0].phys = 0x100000000ULL - size;
+	windows[1].phys = 0xFFFFFFFF - 0x400000 - size + 1;
+	for (i = 0; i < 2; i++) {
+		windows[i].len = size;
+		windows[i].virt = sim_map(windows[i].phys, size);
+		if (windows[i].virt == NULL)
+			exit(1);
+	}
+
+	memset(&st, 0, sizeof(st));
+	start_ns = sim_clock_ns();
+
+	for (i = 0; i < header.records; i++) {
+		if (fread(&r, sizeof(r), 1, f) != 1) {
+			fprintf(stderr, "Error: %s ends after %lu of %lu "
+				"records\n", argv[optind], i,
+				(unsigned long)header.records);
+			ret = 1;
+			break;
+		}
+		if (i == 0)
+			first_usec = prev_usec = r.usec;
+		gap = r.usec - prev_usec;
+		prev_usec = r.usec;
+
+		/* the rest of a recorded poll loop the model no longer needs */
+		if (polling && r.kind == TRACE_READ &&
+		    r.address == poll_address) {
+			poll_reads++;
+			poll_last = r.usec;
+			if (poll_done) {
+				st.skipped_polls++;
+				continue;
+			}
+		} else if (polling) {
+			/* the model is slower than the recorded chip */
+			uint32_t spacing = (poll_last - poll_start) / poll_reads;
+			unsigned long n = 0;
+
+			addr = replay_addr(poll_address, 1);
+			while (!poll_done && sim_is_busy() &&
+			       n++ < MAX_EXTRA_POLLS) {
+				if (spacing > gap_usec)
+					sim_delay(spacing - gap_usec);
+				chip_readb(addr);
+				st.extra_polls++;
+			}
+			polling = 0;
+		}
+
+		if (gap > gap_usec)
+			sim_delay(gap - gap_usec);
+
+		if (r.kind == TRACE_PORT_IN || r.kind == TRACE_PORT_OUT) {
+			st.port_cycles++;
+			continue;
+		}
+
+		addr = replay_addr(r.address,
+				   r.kind == TRACE_READN ? r.value : 1);
+		if (addr == NULL) {
+			st.unmapped++;
+			continue;
+		}
+
+		switch (r.kind) {
+		case TRACE_WRITE:
+			chip_writeb(r.value, addr);
+			st.writes++;
+			break;
+		case TRACE_READN:
+			for (j = 0; j < r.value; j++)
+				chip_readb(addr + j);
+			st.bulk_bytes += r.value;
+			break;
+		case TRACE_READ:
+			st.reads++;
+			if (polling) {
+				chip_readb(addr);
+				poll_done = !sim_is_busy();
+				break;
+			}
+			if (sim_is_busy()) {
+				polling = 1;
+				poll_done = 0;
+				poll_reads = 1;
+				poll_address = r.address;
+				poll_start = poll_last = r.usec;
+				chip_readb(addr);
+				poll_done = !sim_is_busy();
+				break;
+			}
+			val = chip_readb(addr);
+			if (val != (uint8_t)r.value &&
+			    st.read_mismatches++ < MAX_REPORTED_MISMATCHES)
+				fprintf(stderr, "read at 0x%08x: traced 0x%02x, "
+					"model 0x%02x\n", r.address,
+					r.value & 0xff, val);
+			break;
+		}
+	}
+	fclose(f);
+	st.recorded_us = prev_usec - first_usec;
+
+	if (expected != NULL) {
+		if (check_image(expected, size, &differing))
+			ret = 1;
+		else if (differing)
+			ret = 1;
+	}
+
+	printf("{\"chip\": \"%s\", \"records\": %lu, \"lost\": %lu,\n",
+	       sim_chip_name(), (unsigned long)header.records,
+	       (unsigned long)header.lost);
+	printf(" \"reads\": %lu, \"writes\": %lu, \"bulk_read_bytes\": %lu, "
+	       "\"port_cycles\": %lu, \"unmapped\": %lu,\n",
+	       st.reads, st.writes, st.bulk_bytes, st.port_cycles,
+	       st.unmapped);
+	printf(" \"skipped_polls\": %lu, \"extra_polls\": %lu, "
+	       "\"read_mismatches\": %lu,\n",
+	       st.skipped_polls, st.extra_polls, st.read_mismatches);
+	printf(" \"recorded_us\": %.0f, \"model_us\": %.0f,\n",
+	       (double)st.recorded_us,
+	       (double)(sim_clock_ns() - start_ns) / 1000);
+	if (expected != NULL)
+		printf(" \"expected\": \"%s\", \"differing_bytes\": %lu}\n",
+		       differing ? "mismatch" : "match", differing);
+	else
+		printf(" \"expected\": null}\n");
+
+	sim_exit();
+	return ret;
+}
@@ -27,6 +27,8 @@
 
 #include "flash.h"
 #include "sharplhf00l04.h"
+#include "82802ab.h"
+#include "writeplan.h"
 #include "debug.h"
 
 // I need that Berkeley bit-map printer
@@ -46,27 +48,31 @@ int probe_lhf00l04(struct flashchip *flash)
 	volatile uint8_t *bios = flash->virtual_memory;
 	uint8_t id1, id2;
 
+	if (!probe_id_cached(probe_lhf00l04, bios, &id1, &id2)) {
 #if 0
-	/* Enter ID mode */
-	*(volatile uint8_t *)(bios + 0x5555) = 0xAA;
-	*(volatile uint8_t *)(bios + 0x2AAA) = 0x55;
-	*(volatile uint8_t *)(bios + 0x5555) = 0x90;
+		/* Enter ID mode */
+		chip_writeb(0xAA, bios + 0x5555);
+		chip_writeb(0x55, bios + 0x2AAA);
+		chip_writeb(0x90, bios + 0x5555);
 #endif
 
-	*bios = 0xff;
-	myusec_delay(10);
-	*bios = 0x90;
-	myusec_delay(10);
+		chip_writeb(0xff, bios);
+		myusec_delay(10);
+		chip_writeb(0x90, bios);
+		myusec_delay(10);
 
-	id1 = *(volatile uint8_t *)bios;
-	id2 = *(volatile uint8_t *)(bios + 0x01);
+		id1 = chip_readb(bios);
+		id2 = chip_readb(bios + 0x01);
 
-	/* Leave ID mode */
-	*(volatile uint8_t *)(bios + 0x5555) = 0xAA;
-	*(volatile uint8_t *)(bios + 0x2AAA) = 0x55;
-	*(volatile uint8_t *)(bios + 0x5555) = 0xF0;
+		/* Leave ID mode */
+		chip_writeb(0xAA, bios + 0x5555);
+		chip_writeb(0x55, bios + 0x2AAA);
+		chip_writeb(0xF0, bios + 0x5555);
 
-	myusec_delay(10);
+		myusec_delay(10);
+
+		probe_id_store(probe_lhf00l04, bios, id1, id2);
+	}
 
 	printf_debug("%s: id1 0x%x, id2 0x%x\n", __FUNCTION__, id1, id2);
 
@@ -78,61 +84,25 @@ int probe_lhf00l04(struct flashchip *flash)
 	return 1;
 }
 
-uint8_t wait_lhf00l04(volatile uint8_t *bios)
-{
-
-	uint8_t status;
-	uint8_t id1, id2;
-
-	*bios = 0x70;
-	if ((*bios & 0x80) == 0) {	// it's busy
-		while ((*bios & 0x80) == 0) ;
-	}
-
-	status = *bios;
-
-	// put another command to get out of status register mode
-
-	*bios = 0x90;
-	myusec_delay(10);
-
-	id1 = *(volatile uint8_t *)bios;
-	id2 = *(volatile uint8_t *)(bios + 0x01);
-
-	// this is needed to jam it out of "read id" mode
-	*(volatile uint8_t *)(bios + 0x5555) = 0xAA;
-	*(volatile uint8_t *)(bios + 0x2AAA) = 0x55;
-	*(volatile uint8_t *)(bios + 0x5555) = 0xF0;
-	return status;
-
-}
-int erase_lhf00l04_block(struct flashchip *flash, int offset)
+int erase_lhf00l04_block(struct flashchip *flash, unsigned int offset,
+			 unsigned int size)
 {
 	volatile uint8_t *bios = flash->virtual_memory + offset;
 	volatile uint8_t *wrprotect = flash->virtual_registers + offset + 2;
-	uint8_t status;
 
 	// clear status register
-	*bios = 0x50;
-	printf("Erase at %p\n", bios);
-	status = wait_lhf00l04(flash->virtual_memory);
-	print_lhf00l04_status(status);
+	chip_writeb(0x50, bios);
 	// clear write protect
-	printf("write protect is at %p\n", (wrprotect));
-	printf("write protect is 0x%x\n", *(wrprotect));
-	*(wrprotect) = 0;
-	printf("write protect is 0x%x\n", *(wrprotect));
+	chip_writeb(0, wrprotect);
 
 	// now start it
-	*(volatile uint8_t *)(bios) = 0x20;
-	*(volatile uint8_t *)(bios) = 0xd0;
-	myusec_delay(10);
-	// now let's see what the register is
-	status = wait_lhf00l04(flash->virtual_memory);
-	print_lhf00l04_status(status);
-	printf("DONE BLOCK 0x%x\n", offset);
-	return (0);
+	chip_writeb(0x20, bios);
+	chip_writeb(0xd0, bios);
+
+	/* the LHF00L04 reports an erase like the 82802AB */
+	return wait_erase_82802ab(flash, offset, print_lhf00l04_status);
 }
+
 int erase_lhf00l04(struct flashchip *flash)
 {
 	int i;
@@ -141,45 +111,28 @@ int erase_lhf00l04(struct flashchip *flash)
 	printf("total_size is %d; flash->page_size is %d\n",
 	       total_size, flash->page_size);
 	for (i = 0; i < total_size; i += flash->page_size)
-		erase_lhf00l04_block(flash, i);
+		if (erase_lhf00l04_block(flash, i, flash->page_size))
+			return -1;
 	printf("DONE ERASE\n");
 	return (0);
 }
 
-void write_page_lhf00l04(volatile uint8_t *bios, uint8_t *src,
-			 volatile uint8_t *dst, int page_size)
+/* The LHF00L04 programs like the 82802AB */
+static int program_block_lhf00l04(struct flashchip *flash, uint8_t *src,
+				  const uint8_t *old, unsigned int offset,
+				  unsigned int size)
 {
-	int i;
-
-	for (i = 0; i < page_size; i++) {
-		/* transfer data from source to destination */
-		*dst = 0x40;
-		*dst++ = *src++;
-		wait_lhf00l04(bios);
-	}
-
+	return write_block_82802ab(flash, src, old, offset, size,
+				   print_lhf00l04_status);
 }
 
 int write_lhf00l04(struct flashchip *flash, uint8_t *buf)
 {
-	int i;
-	int total_size = flash->total_size * 1024;
-	int page_size = flash->page_size;
-	volatile uint8_t *bios = flash->virtual_memory;
+	int ret;
 
-	erase_lhf00l04(flash);
-	if (*bios != 0xff) {
-		printf("ERASE FAILED\n");
-		return -1;
-	}
-	printf("Programming Page: ");
-	for (i = 0; i < total_size / page_size; i++) {
-		printf("%04d at address: 0x%08x", i, i * page_size);
-		write_page_lhf00l04(bios, buf + i * page_size,
-				    bios + i * page_size, page_size);
-		printf("\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
-	}
-	printf("\n");
-	protect_lhf00l04(bios);
-	return (0);
+	ret = write_flash_blocks(flash, buf, flash->page_size,
+				 erase_lhf00l04_block, program_block_lhf00l04);
+	protect_lhf00l04(flash->virtual_memory);
+
+	return ret;
 }
@@ -0,0 +1,659 @@
+/*
+ * sim.c: software flash chip simulator
+ *
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *
+ * With --simulate, physical mappings are backed by plain memory and every
+ * chip_readb()/chip_writeb() lands here instead of on the bus. Accesses
+ * that fall into the simulated chip (the top of the 4 GB space) run
+ * through a command state machine for the chip's family:
+ *
+ *  - JEDEC/AMD:  AA/55 unlock cycles, ID mode, byte program, page write,
+ *                sector/block/chip erase, DQ6 toggle and DQ7 data polling,
+ *                unlock bypass on chips with FEATURE_UNLOCK_BYPASS
+ *  - SST 28SF:   single cycle program/erase/ID commands with DQ6 toggle
+ *  - Intel FWH:  82802AB, LHF00L04 and SST 49LFxxxC; status register
+ *                with WSM ready bit, block and sector erase, byte program
+ *
+ * Time is virtual: each bus access costs access_ns, and myusec_delay()
+ * advances the clock instead of waiting. Program and erase operations
+ * stay busy for their configured latency on that clock, so the drivers'
+ * polling loops behave as they would on hardware, only much faster.
+ * Everything else in the mapping (e.g. FWH lock registers) is memory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "flash.h"
+#include "jedec.h"
+#include "sst28sf040.h"
+#include "sst49lfxxxc.h"
+#include "82802ab.h"
+#include "sharplhf00l04.h"
+#include "msys_doc.h"
+#include "sst_fwhub.h"
+#include "sim.h"
+#include "writeplan.h"
+#include "debug.h"
+
+#define SIM_MAX_MAPPINGS	8
+
+/* Latencies used when the chip has no timing table, in ns */
+#define SIM_PROGRAM_NS		(20 * 1000)
+#define SIM_SECTOR_ERASE_NS	(25 * 1000 * 1000)
+#define SIM_BLOCK_ERASE_NS	(25 * 1000 * 1000)
+#define SIM_CHIP_ERASE_NS	(100 * 1000 * 1000)
+#define SIM_ACCESS_NS		1000
+
+enum sim_family {
+	SIM_JEDEC,
+	SIM_28SF,
+	SIM_INTEL,
+};
+
+enum sim_state {
+	S_READ,
+	S_ID,
+	S_STATUS,
+	S_UNLOCK1,		/* AA */
+	S_UNLOCK2,		/* AA 55 */
+	S_ERASE0,		/* AA 55 80 */
+	S_ERASE1,		/* AA 55 80 AA */
+	S_ERASE2,		/* AA 55 80 AA 55 */
+	S_PROGRAM,		/* next write is the data */
+	S_PAGE_LOAD,		/* JEDEC page write, until the next read */
+	S_ERASE_SETUP,		/* 28SF 20, Intel 20 (block) */
+	S_SECTOR_SETUP,		/* Intel 30 (sector) */
+	S_CHIP_SETUP,		/* 28SF 30 */
+	S_BYPASS_EXIT,		/* unlock bypass 90 */
+};
+
+struct sim_mapping {
+	volatile uint8_t *virt;
+	uint64_t phys;
+	unsigned long len;
+};
+
+int sim_active = 0;
+
+static struct {
+	struct flashchip *flash;
+	int family;
+	int state;
+	uint8_t *data;
+	unsigned int size;
+	uint64_t base;		/* physical address of the first byte */
+	unsigned int sector_size;
+	int page_write;
+	int bypass;		/* in unlock bypass mode */
+	int page_loaded;	/* a page write has its first byte */
+
+	uint64_t now;		/* virtual clock, ns */
+	uint64_t busy_until;
+	uint8_t busy_data;	/* byte being programmed, 0xff for erase */
+	uint8_t toggle;
+
+	unsigned long program_ns, sector_erase_ns, block_erase_ns;
+	unsigned long chip_erase_ns, access_ns;
+	unsigned long reads, writes, polls;
+} sim;
+
+static struct sim_mapping mappings[SIM_MAX_MAPPINGS];
+
+static unsigned long sim_latency(unsigned long typ, unsigned long max,
+				 unsigned long def)
+{
+	/* typ and max are in us; fall back to half the maximum */
+	if (typ)
+		return typ * 1000;
+	if (max)
+		return max / 2 * 1000;
+	return def;
+}
+
+static int sim_option(char *opt)
+{
+	char *val = strchr(opt, '=');
+	FILE *image;
+
+	if (val == NULL)
+		goto bad;
+	*val++ = '\0';
+
+	if (!strcmp(opt, "image")) {
+		if ((image = fopen(val, "rb")) == NULL) {
+			perror(val);
+			return -1;
+		}
+		if (fread(sim.data, 1, sim.size, image) != sim.size) {
+			fprintf(stderr, "Error: %s is not a %d KB image\n",
+				val, sim.size / 1024);
+			fclose(image);
+			return -1;
+		}
+		fclose(image);
+	} else if (!strcmp(opt, "program"))
+		sim.program_ns = strtoul(val, NULL, 0) * 1000;
+	else if (!strcmp(opt, "sector"))
+		sim.sector_erase_ns = strtoul(val, NULL, 0) * 1000;
+	else if (!strcmp(opt, "block"))
+		sim.block_erase_ns = strtoul(val, NULL, 0) * 1000;
+	else if (!strcmp(opt, "chip"))
+		sim.chip_erase_ns = strtoul(val, NULL, 0) * 1000;
+	else if (!strcmp(opt, "access"))
+		sim.access_ns = strtoul(val, NULL, 0);
+	else
+		goto bad;
+
+	return 0;
+
+bad:
+	fprintf(stderr, "Error: unknown simulator option \"%s\"\n", opt);
+	return -1;
+}
+
+/*
+ * spec is "chipname[,image=file][,program=us][,sector=us][,block=us]
+ * [,chip=us][,access=ns]". The chip starts out erased unless an image
+ * is given.
+ */
+int sim_init(const char *spec)
+{
+	const struct flashchip_timing *t;
+	struct flashchip *flash;
+	char *copy, *name, *opt;
+
+	copy = strdup(spec);
+	name = strtok(copy, ",");
+	for (flash = flashchips; flash->name != NULL; flash++)
+		if (name && !strcmp(flash->name, name))
+			break;
+	if (flash->name == NULL) {
+		fprintf(stderr, "Error: can't simulate unknown chip \"%s\"\n",
+			name ? name : "");
+		free(copy);
+		return -1;
+	}
+
+#ifndef DISABLE_DOC
+	if (flash->probe == probe_md2802) {
+		fprintf(stderr, "Error: DiskOnChip can't be simulated\n");
+		free(copy);
+		return -1;
+	}
+#endif
+
+	sim.flash = flash;
+	sim.size = flash->total_size * 1024;
+	sim.base = 0x100000000ULL - sim.size;
+	sim.data = (uint8_t *) malloc(sim.size);
+	if (sim.data == NULL) {
+		fprintf(stderr, "Error: Out of memory for the simulator\n");
+		free(copy);
+		return -1;
+	}
+	memset(sim.data, 0xff, sim.size);
+
+	if (flash->probe == probe_28sf040)
+		sim.family = SIM_28SF;
+	else if (flash->probe == probe_49lfxxxc ||
+		 flash->probe == probe_82802ab ||
+		 flash->probe == probe_lhf00l04)
+		sim.family = SIM_INTEL;
+	else
+		sim.family = SIM_JEDEC;
+
+	/* FWH parts erase 4 KB sectors with 30 and page_size blocks with 50 */
+	sim.sector_size = flash->page_size;
+	if (flash->probe == probe_sst_fwhub || sim.family == SIM_INTEL)
+		sim.sector_size = 4096;
+	sim.page_write = (flash->write == write_jedec);
+
+	t = flash->timing;
+	if (t != NULL) {
+		sim.program_ns = sim_latency(t->program_typ, t->program_max,
+					     SIM_PROGRAM_NS);
+		sim.sector_erase_ns = sim_latency(t->sector_erase_typ,
+						  t->sector_erase_max,
+						  SIM_SECTOR_ERASE_NS);
+		sim.block_erase_ns = sim_latency(t->block_erase_typ,
+						 t->block_erase_max,
+						 SIM_BLOCK_ERASE_NS);
+		sim.chip_erase_ns = sim_latency(t->chip_erase_typ,
+						t->chip_erase_max,
+						SIM_CHIP_ERASE_NS);
+	} else {
+		sim.program_ns = SIM_PROGRAM_NS;
+		sim.sector_erase_ns = SIM_SECTOR_ERASE_NS;
+		sim.block_erase_ns = SIM_BLOCK_ERASE_NS;
+		sim.chip_erase_ns = SIM_CHIP_ERASE_NS;
+	}
+	sim.access_ns = SIM_ACCESS_NS;
+
+	while ((opt = strtok(NULL, ",")) != NULL) {
+		if (sim_option(opt)) {
+			free(copy);
+			return -1;
+		}
+	}
+	free(copy);
+
+	sim.state = S_READ;
+	sim.bypass = 0;
+	sim_active = 1;
+
+	printf_debug("sim: program %lu ns, sector %lu ns, block %lu ns, "
+		     "chip %lu ns, access %lu ns\n", sim.program_ns,
+		     sim.sector_erase_ns, sim.block_erase_ns,
+		     sim.chip_erase_ns, sim.access_ns);
+
+	return 0;
+}
+
+const char *sim_chip_name(void)
+{
+	return sim.flash->name;
+}
+
+/* Stand-in for a physical mapping: plain memory remembered by address */
+volatile uint8_t *sim_map(uint64_t phys, unsigned long len)
+{
+	int i;
+
+	for (i = 0; i < SIM_MAX_MAPPINGS; i++) {
+		if (mappings[i].virt != NULL)
+			continue;
+		mappings[i].virt = (volatile uint8_t *) calloc(len, 1);
+		if (mappings[i].virt == NULL)
+			break;
+		mappings[i].phys = phys;
+		mappings[i].len = len;
+		return mappings[i].virt;
+	}
+
+	fprintf(stderr, "Error: simulator can't map 0x%lx bytes\n", len);
+	return NULL;
+}
+
+void sim_unmap(volatile uint8_t *virt)
+{
+	int i;
+
+	for (i = 0; i < SIM_MAX_MAPPINGS; i++) {
+		if (mappings[i].virt != virt)
+			continue;
+		free((void *)mappings[i].virt);
+		mappings[i].virt = NULL;
+		return;
+	}
+}
+
+void sim_delay(unsigned long usec)
+{
+	sim.now += (uint64_t)usec * 1000;
+}
+
+uint64_t sim_clock_ns(void)
+{
+	return sim.now;
+}
+
+void sim_get_counters(struct sim_counters *c)
+{
+	c->reads = sim.reads;
+	c->writes = sim.writes;
+	c->polls = sim.polls;
+}
+
+/* Whether a program or erase is still in progress */
+int sim_is_busy(void)
+{
+	return sim.now < sim.busy_until;
+}
+
+/* The array as the chip would return it in read mode */
+const uint8_t *sim_contents(void)
+{
+	return sim.data;
+}
+
+/* Drop the simulated chip, so another one can be set up */
+void sim_exit(void)
+{
+	free(sim.data);
+	memset(&sim, 0, sizeof(sim));
+	sim_active = 0;
+}
+
+/* Offset into the simulated chip, or -1 for anything else */
+static long sim_offset(const volatile uint8_t *addr)
+{
+	uint64_t phys;
+	int i;
+
+	for (i = 0; i < SIM_MAX_MAPPINGS; i++) {
+		if (mappings[i].virt == NULL || addr < mappings[i].virt ||
+		    addr >= mappings[i].virt + mappings[i].len)
+			continue;
+		phys = mappings[i].phys + (addr - mappings[i].virt);
+		if (phys < sim.base || phys >= sim.base + sim.size)
+			return -1;
+		return (long)(phys - sim.base);
+	}
+
+	return -1;
+}
+
+static void sim_start(unsigned long ns, uint8_t data)
+{
+	sim.busy_until = sim.now + ns;
+	sim.busy_data = data;
+}
+
+static void sim_program(long off, uint8_t val)
+{
+	/* programming can only clear bits */
+	sim.data[off] &= val;
+	sim_start(sim.program_ns, val);
+}
+
+/*
+ * Erase the block of the given command that holds off. The chip's
+ * erase_regions table gives the block, if it has one for the command;
+ * otherwise the block is size bytes.
+ */
+static void sim_erase(long off, uint8_t opcode, unsigned int size,
+		      unsigned long ns)
+{
+	struct erase_block b;
+
+	if (opcode && find_erase_block(sim.flash, opcode, off, &b) == 0) {
+		off = b.offset;
+		size = b.size;
+	} else
+		off -= off % size;
+	memset(sim.data + off, 0xff, size);
+	sim_start(ns, 0xff);
+}
+
+static uint8_t sim_id(long off)
+{
+	if ((off & 3) == 0)
+		return sim.flash->manufacture_id;
+	return sim.flash->model_id;
+}
+
+/* DQ7 shows the complement of the data, DQ6 toggles on every read */
+static uint8_t sim_toggle_status(void)
+{
+	sim.polls++;
+	sim.toggle ^= 0x40;
+	return (~sim.busy_data & 0x80) | sim.toggle;
+}
+
+static void jedec_write(long off, uint8_t val)
+{
+	if (sim.state == S_PAGE_LOAD) {
+		/* the page is written as loaded, no erase needed; parts
+		 * that erase it first leave unloaded bytes at 0xff */
+		if (!sim.page_loaded &&
+		    (sim.flash->feature_bits & FEATURE_PAGE_WRITE))
+			memset(sim.data + off - off % sim.flash->page_size,
+			       0xff, sim.flash->page_size);
+		sim.page_loaded = 1;
+		sim.data[off] = val;
+		sim_start(sim.program_ns, val);
+		return;
+	}
+	if (sim_is_busy())
+		return;
+	if (sim.state == S_PROGRAM) {
+		sim_program(off, val);
+		sim.state = S_READ;
+		return;
+	}
+	if (sim.bypass) {
+		/* only A0 (program) and 90 00 (exit) are accepted */
+		if (sim.state == S_BYPASS_EXIT) {
+			if (val == 0x00)
+				sim.bypass = 0;
+			sim.state = S_READ;
+		} else if (val == 0xa0) {
+			sim.state = S_PROGRAM;
+		} else if (val == 0x90) {
+			sim.state = S_BYPASS_EXIT;
+		}
+		return;
+	}
+	if (val == 0xf0) {
+		sim.state = S_READ;
+		return;
+	}
+
+	switch (sim.state) {
+	case S_UNLOCK1:
+		sim.state = (val == 0x55) ? S_UNLOCK2 : S_READ;
+		break;
+	case S_UNLOCK2:
+		sim.state = S_READ;
+		if (val == 0x90) {
+			sim.state = S_ID;
+		} else if (val == 0xa0) {
+			sim.state = sim.page_write ? S_PAGE_LOAD : S_PROGRAM;
+			sim.page_loaded = 0;
+		} else if (val == 0x80) {
+			sim.state = S_ERASE0;
+		} else if (val == 0x20 && (sim.flash->feature_bits &
+					   FEATURE_UNLOCK_BYPASS)) {
+			sim.bypass = 1;
+		}
+		break;
+	case S_ERASE0:
+		sim.state = (val == 0xaa) ? S_ERASE1 : S_READ;
+		break;
+	case S_ERASE1:
+		sim.state = (val == 0x55) ? S_ERASE2 : S_READ;
+		break;
+	case S_ERASE2:
+		if (val == 0x10)
+			sim_erase(0, 0, sim.size, sim.chip_erase_ns);
+		else if (val == 0x30)
+			sim_erase(off, val, sim.sector_size,
+				  sim.sector_erase_ns);
+		else if (val == 0x50)
+			sim_erase(off, val, sim.flash->page_size,
+				  sim.block_erase_ns);
+		sim.state = S_READ;
+		break;
+	default:
+		if (val == 0xaa)
+			sim.state = S_UNLOCK1;
+		break;
+	}
+}
+
+static uint8_t jedec_read(long off)
+{
+	if (sim.state == S_PAGE_LOAD)
+		sim.state = S_READ;
+	if (sim_is_busy())
+		return sim_toggle_status();
+	if (sim.state == S_ID)
+		return sim_id(off);
+	return sim.data[off];
+}
+
+static void sf28_write(long off, uint8_t val)
+{
+	if (sim_is_busy())
+		return;
+
+	switch (sim.state) {
+	case S_PROGRAM:
+		sim_program(off, val);
+		sim.state = S_READ;
+		break;
+	case S_ERASE_SETUP:
+		if (val == 0xd0)
+			sim_erase(off, 0x20, sim.flash->page_size,
+				  sim.sector_erase_ns);
+		sim.state = S_READ;
+		break;
+	case S_CHIP_SETUP:
+		if (val == 0x30)
+			sim_erase(0, 0, sim.size, sim.chip_erase_ns);
+		sim.state = S_READ;
+		break;
+	default:
+		if (val == 0x10)
+			sim.state = S_PROGRAM;
+		else if (val == 0x20)
+			sim.state = S_ERASE_SETUP;
+		else if (val == 0x30)
+			sim.state = S_CHIP_SETUP;
+		else if (val == 0x90)
+			sim.state = S_ID;
+		else
+			sim.state = S_READ;
+		break;
+	}
+}
+
+static uint8_t sf28_read(long off)
+{
+	if (sim_is_busy())
+		return sim_toggle_status();
+	if (sim.state == S_ID)
+		return sim_id(off);
+	return sim.data[off];
+}
+
+static void intel_write(long off, uint8_t val)
+{
+	if (sim_is_busy()) {
+		if (val == 0x70)
+			sim.state = S_STATUS;
+		return;
+	}
+
+	switch (sim.state) {
+	case S_PROGRAM:
+		sim_program(off, val);
+		sim.state = S_STATUS;
+		return;
+	case S_ERASE_SETUP:
+	case S_SECTOR_SETUP:
+		if (val == 0xd0) {
+			if (sim.state == S_ERASE_SETUP)
+				sim_erase(off, 0x20, sim.flash->page_size,
+					  sim.block_erase_ns);
+			else
+				sim_erase(off, 0x30, sim.sector_size,
+					  sim.sector_erase_ns);
+			sim.state = S_STATUS;
+		} else
+			sim.state = S_READ;
+		return;
+	default:
+		break;
+	}
+
+	switch (val) {
+	case 0x10:
+	case 0x40:
+		sim.state = S_PROGRAM;
+		break;
+	case 0x20:
+		sim.state = S_ERASE_SETUP;
+		break;
+	case 0x30:
+		sim.state = S_SECTOR_SETUP;
+		break;
+	case 0x50:
+		/* clear status: nothing ever fails here */
+		break;
+	case 0x70:
+		sim.state = S_STATUS;
+		break;
+	case 0x90:
+		sim.state = S_ID;
+		break;
+	default:
+		/* 0xff and anything unknown return to read array mode */
+		sim.state = S_READ;
+		break;
+	}
+}
+
+static uint8_t intel_read(long off)
+{
+	if (sim.state == S_STATUS) {
+		sim.polls++;
+		return sim_is_busy() ? 0x00 : 0x80;
+	}
+	if (sim.state == S_ID)
+		return sim_id(off);
+	return sim.data[off];
+}
+
+uint8_t sim_readb(const volatile uint8_t *addr)
+{
+	long off = sim_offset(addr);
+
+	sim.now += sim.access_ns;
+	sim.reads++;
+
+	if (off < 0)
+		return *addr;
+
+	switch (sim.family) {
+	case SIM_28SF:
+		return sf28_read(off);
+	case SIM_INTEL:
+		return intel_read(off);
+	default:
+		return jedec_read(off);
+	}
+}
+
+void sim_writeb(uint8_t val, volatile uint8_t *addr)
+{
+	long off = sim_offset(addr);
+
+	sim.now += sim.access_ns;
+	sim.writes++;
+
+	if (off < 0) {
+		*addr = val;
+		return;
+	}
+
+	switch (sim.family) {
+	case SIM_28SF:
+		sf28_write(off, val);
+		break;
+	case SIM_INTEL:
+		intel_write(off, val);
+		break;
+	default:
+		jedec_write(off, val);
+		break;
+	}
+}
@@ -0,0 +1,23 @@
+#ifndef __SIM_H__
+#define __SIM_H__ 1
+
+extern int sim_init(const char *spec);
+extern const char *sim_chip_name(void);
+extern volatile uint8_t *sim_map(uint64_t phys, unsigned long len);
+extern void sim_unmap(volatile uint8_t *virt);
+extern void sim_delay(unsigned long usec);
+extern uint64_t sim_clock_ns(void);
+
+/* Bus cycles seen by the simulated chip; polls are reads that returned
+ * status (toggle bits or the status register) instead of array data.
+ */
+struct sim_counters {
+	unsigned long reads, writes, polls;
+};
+
+extern void sim_get_counters(struct sim_counters *c);
+extern void sim_exit(void);
+extern int sim_is_busy(void);
+extern const uint8_t *sim_contents(void);
+
+#endif				/* !__SIM_H__ */
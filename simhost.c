@@ -0,0 +1,69 @@
+/*
+ * simhost.c: what flashrom.c provides to the drivers, for the tools that
+ * run them on the simulator without flashrom.c (flashbench, flashreplay)
+ *
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "flash.h"
+#include "direct_io.h"
+#include "sim.h"
+
+/* There is no probe cache here */
+int force = 0, verbose = 0;
+
+int map_flash_registers(struct flashchip *flash)
+{
+	size_t size = flash->total_size * 1024;
+
+	flash->virtual_registers = sim_map(0xFFFFFFFF - 0x400000 - size + 1,
+					   size);
+	if (flash->virtual_registers == NULL)
+		exit(1);
+
+	return 0;
+}
+
+int probe_id_cached(int (*method) (struct flashchip *flash),
+		    volatile uint8_t *bios, uint8_t *id1, uint8_t *id2)
+{
+	return 0;
+}
+
+void probe_id_store(int (*method) (struct flashchip *flash),
+		    volatile uint8_t *bios, uint8_t id1, uint8_t id2)
+{
+}
+
+/*
+ * direct_io.c needs the Windows driver. Drivers only map physical memory
+ * themselves when the simulator is off, which never happens here.
+ */
+void *map_physical_addr_range(unsigned long phy_addr_start,
+			      unsigned long size)
+{
+	return NULL;
+}
+
+int unmap_physical_addr_range(void *virt_addr_start, unsigned long size)
+{
+	return 0;
+}
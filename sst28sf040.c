@@ -29,6 +29,7 @@
 #include <stdint.h>
 #include "flash.h"
 #include "jedec.h"
+#include "writeplan.h"
 #include "debug.h"
 
 #define AUTO_PG_ERASE1		0x20
@@ -40,64 +41,57 @@
 
 static __inline__ void protect_28sf040(volatile uint8_t *bios)
 {
-	/* ask compiler not to optimize this */
-	volatile uint8_t tmp;
-
-	tmp = *(volatile uint8_t *)(bios + 0x1823);
-	tmp = *(volatile uint8_t *)(bios + 0x1820);
-	tmp = *(volatile uint8_t *)(bios + 0x1822);
-	tmp = *(volatile uint8_t *)(bios + 0x0418);
-	tmp = *(volatile uint8_t *)(bios + 0x041B);
-	tmp = *(volatile uint8_t *)(bios + 0x0419);
-	tmp = *(volatile uint8_t *)(bios + 0x040A);
+	chip_readb(bios + 0x1823);
+	chip_readb(bios + 0x1820);
+	chip_readb(bios + 0x1822);
+	chip_readb(bios + 0x0418);
+	chip_readb(bios + 0x041B);
+	chip_readb(bios + 0x0419);
+	chip_readb(bios + 0x040A);
 }
 
 static __inline__ void unprotect_28sf040(volatile uint8_t *bios)
 {
-	/* ask compiler not to optimize this */
-	volatile uint8_t tmp;
-
-	tmp = *(volatile uint8_t *)(bios + 0x1823);
-	tmp = *(volatile uint8_t *)(bios + 0x1820);
-	tmp = *(volatile uint8_t *)(bios + 0x1822);
-	tmp = *(volatile uint8_t *)(bios + 0x0418);
-	tmp = *(volatile uint8_t *)(bios + 0x041B);
-	tmp = *(volatile uint8_t *)(bios + 0x0419);
-	tmp = *(volatile uint8_t *)(bios + 0x041A);
+	chip_readb(bios + 0x1823);
+	chip_readb(bios + 0x1820);
+	chip_readb(bios + 0x1822);
+	chip_readb(bios + 0x0418);
+	chip_readb(bios + 0x041B);
+	chip_readb(bios + 0x0419);
+	chip_readb(bios + 0x041A);
 }
 
-static __inline__ int erase_sector_28sf040(volatile uint8_t *bios,
+static __inline__ int erase_sector_28sf040(struct flashchip *flash,
 					   unsigned long address)
 {
-	*bios = AUTO_PG_ERASE1;
-	*(bios + address) = AUTO_PG_ERASE2;
+	volatile uint8_t *bios = flash->virtual_memory;
 
-	/* wait for Toggle bit ready         */
-	toggle_ready_jedec(bios);
+	chip_writeb(AUTO_PG_ERASE1, bios);
+	chip_writeb(AUTO_PG_ERASE2, bios + address);
 
-	return (0);
+	/* wait for Toggle bit ready         */
+	return toggle_ready_jedec(flash, bios, FLASH_OP_SECTOR_ERASE);
 }
 
-static __inline__ int write_sector_28sf040(volatile uint8_t *bios,
+static __inline__ int write_sector_28sf040(struct flashchip *flash,
 					   uint8_t *src,
+					   const uint8_t *old,
 					   volatile uint8_t *dst,
 					   unsigned int page_size)
 {
 	int i;
 
 	for (i = 0; i < page_size; i++) {
-		/* transfer data from source to destination */
-		if (*src == 0xFF) {
-			dst++, src++;
-			/* If the data is 0xFF, don't program it */
+		/* Skip bytes that already match */
+		if (old[i] == src[i])
 			continue;
-		}
 		/*issue AUTO PROGRAM command */
-		*dst = AUTO_PGRM;
-		*dst++ = *src++;
+		chip_writeb(AUTO_PGRM, dst + i);
+		chip_writeb(src[i], dst + i);
 
 		/* wait for Toggle bit ready */
-		toggle_ready_jedec(bios);
+		if (toggle_ready_jedec(flash, dst + i, FLASH_OP_PROGRAM))
+			return -1;
 	}
 
 	return (0);
@@ -108,17 +102,21 @@ int probe_28sf040(struct flashchip *flash)
 	volatile uint8_t *bios = flash->virtual_memory;
 	uint8_t id1, id2;
 
-	*bios = RESET;
-	myusec_delay(10);
+	if (!probe_id_cached(probe_28sf040, bios, &id1, &id2)) {
+		chip_writeb(RESET, bios);
+		myusec_delay(10);
 
-	*bios = READ_ID;
-	myusec_delay(10);
-	id1 = *(volatile uint8_t *)bios;
-	myusec_delay(10);
-	id2 = *(volatile uint8_t *)(bios + 0x01);
+		chip_writeb(READ_ID, bios);
+		myusec_delay(10);
+		id1 = chip_readb(bios);
+		myusec_delay(10);
+		id2 = chip_readb(bios + 0x01);
 
-	*bios = RESET;
-	myusec_delay(10);
+		chip_writeb(RESET, bios);
+		myusec_delay(10);
+
+		probe_id_store(probe_28sf040, bios, id1, id2);
+	}
 
 	printf_debug("%s: id1 0x%x, id2 0x%x\n", __FUNCTION__, id1, id2);
 	if (id1 == flash->manufacture_id && id2 == flash->model_id)
@@ -132,39 +130,40 @@ int erase_28sf040(struct flashchip *flash)
 	volatile uint8_t *bios = flash->virtual_memory;
 
 	unprotect_28sf040(bios);
-	*bios = CHIP_ERASE;
-	*bios = CHIP_ERASE;
+	chip_writeb(CHIP_ERASE, bios);
+	chip_writeb(CHIP_ERASE, bios);
 	protect_28sf040(bios);
 
 	myusec_delay(10);
-	toggle_ready_jedec(bios);
+	return toggle_ready_jedec(flash, bios, FLASH_OP_CHIP_ERASE);
+}
 
-	return (0);
+static int erase_block_28sf040(struct flashchip *flash, unsigned int offset,
+			       unsigned int size)
+{
+	return erase_sector_28sf040(flash, offset);
+}
+
+static int program_block_28sf040(struct flashchip *flash, uint8_t *src,
+				 const uint8_t *old, unsigned int offset,
+				 unsigned int size)
+{
+	volatile uint8_t *bios = flash->virtual_memory;
+
+	return write_sector_28sf040(flash, src, old, bios + offset, size);
 }
 
 int write_28sf040(struct flashchip *flash, uint8_t *buf)
 {
-	int i;
-	int total_size = flash->total_size * 1024;
-	int page_size = flash->page_size;
+	int ret;
 	volatile uint8_t *bios = flash->virtual_memory;
 
 	unprotect_28sf040(bios);
 
-	printf("Programming Page: ");
-	for (i = 0; i < total_size / page_size; i++) {
-		/* erase the page before programming */
-		erase_sector_28sf040(bios, i * page_size);
-
-		/* write to the sector */
-		printf("%04d at address: 0x%08x", i, i * page_size);
-		write_sector_28sf040(bios, buf + i * page_size,
-				     bios + i * page_size, page_size);
-		printf("\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
-	}
-	printf("\n");
+	ret = write_flash_blocks(flash, buf, flash->page_size,
+				 erase_block_28sf040, program_block_28sf040);
 
 	protect_28sf040(bios);
 
-	return (0);
+	return ret;
 }
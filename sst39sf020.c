@@ -31,41 +31,36 @@
 #include "flash.h"
 #include "jedec.h"
 #include "sst39sf020.h"
+#include "writeplan.h"
 
-#define AUTO_PG_ERASE1		0x20
-#define AUTO_PG_ERASE2		0xD0
-
-static __inline__ int erase_sector_39sf020(volatile uint8_t *bios,
+/* 4K sector erase. This is the JEDEC six cycle sequence ending in 30;
+ * the single 20/D0 pair of the 28SF parts is not a 39SF command.
+ */
+static __inline__ int erase_sector_39sf020(struct flashchip *flash,
 					   unsigned long address)
 {
-	*bios = AUTO_PG_ERASE1;
-	*(bios + address) = AUTO_PG_ERASE2;
-
-	/* wait for Toggle bit ready         */
-	toggle_ready_jedec(bios);
-
-	return (0);
+	return erase_sector_jedec(flash, address);
 }
 
-int write_39sf020(struct flashchip *flash, uint8_t *buf)
+static int erase_block_39sf020(struct flashchip *flash, unsigned int offset,
+			       unsigned int size)
 {
-	int i;
-	int total_size = flash->total_size * 1024;
-	int page_size = flash->page_size;
-	volatile uint8_t *bios = flash->virtual_memory;
+	return erase_sector_39sf020(flash, offset);
+}
 
-	erase_chip_jedec(flash);
+/* sector erase, or a chip erase when most sectors change anyway */
+static const struct erase_method erase_methods_39sf020[] = {
+	{0x30, erase_block_39sf020},
+	{0, NULL},
+};
 
-	printf("Programming Page: ");
-	for (i = 0; i < total_size / page_size; i++) {
-		/* write to the sector */
-		printf("%04d at address: 0x%08x", i, i * page_size);
-		write_sector_jedec(bios, buf + i * page_size,
-				   bios + i * page_size, page_size);
-		printf("\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
-		fflush(stdout);
-	}
-	printf("\n");
+int write_39sf020(struct flashchip *flash, uint8_t *buf)
+{
+	/* without a sector map only the chip erase is known to fit */
+	if (flash->erase_regions == NULL)
+		return write_flash_blocks(flash, buf, flash->page_size, NULL,
+					  program_block_jedec);
 
-	return (0);
+	return write_flash_planned(flash, buf, erase_methods_39sf020, 2,
+				   program_block_jedec);
 }
@@ -25,49 +25,57 @@
  *
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include "flash.h"
 #include "jedec.h"
 #include "sst49lf040.h"
+#include "writeplan.h"
 
 int erase_49lf040(struct flashchip *flash)
 {
-	int i;
-	int total_size = flash->total_size * 1024;
-	int page_size = flash->page_size;
-	volatile uint8_t *bios = flash->virtual_memory;
+	struct erase_block *sectors;
+	int i, n, ret = 0;
 
-	for (i = 0; i < total_size / page_size; i++) {
+	/* page_size is the block size, sectors are smaller */
+	n = flash_erase_blocks(flash, 0x30, &sectors);
+	if (n < 0)
+		return -1;
+
+	for (i = 0; i < n; i++) {
 		/* Chip erase only works in parallel programming mode
 		 * for the 49lf040. Use sector-erase instead */
-		erase_sector_jedec(bios, i * page_size);
+		if (erase_sector_jedec(flash, sectors[i].offset)) {
+			ret = -1;
+			break;
+		}
 	}
-	return 0;
+
+	free(sectors);
+	return ret;
 }
 
-int write_49lf040(struct flashchip *flash, uint8_t *buf)
+static int erase_sector_49lf040(struct flashchip *flash, unsigned int offset,
+				unsigned int size)
 {
-	int i;
-	int total_size = flash->total_size * 1024;
-	int page_size = flash->page_size;
-	volatile uint8_t *bios = flash->virtual_memory;
-
-	printf("Programming Page: ");
-	for (i = 0; i < total_size / page_size; i++) {
-		/* erase the page before programming
-		 * Chip erase only works in parallel programming mode
-		 * for the 49lf040. Use sector-erase instead */
-		erase_sector_jedec(bios, i * page_size);
-
-		/* write to the sector */
-		printf("%04d at address: 0x%08x ", i, i * page_size);
+	/* Chip erase only works in parallel programming mode
+	 * for the 49lf040. Use sector-erase instead */
+	return erase_sector_jedec(flash, offset);
+}
 
-		write_sector_jedec(bios, buf + i * page_size,
-				   bios + i * page_size, page_size);
+static int erase_block_49lf040(struct flashchip *flash, unsigned int offset,
+			       unsigned int size)
+{
+	return erase_block_jedec(flash, offset);
+}
 
-		printf("\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
-		fflush(stdout);
-	}
-	printf("\n");
+/* 4K sector erase or block erase, whichever the plan finds cheaper */
+static const struct erase_method erase_methods_49lf040[] = {
+	{0x30, erase_sector_49lf040},
+	{0x50, erase_block_49lf040},
+};
 
-	return (0);
+int write_49lf040(struct flashchip *flash, uint8_t *buf)
+{
+	return write_flash_planned(flash, buf, erase_methods_49lf040, 2,
+				   program_block_jedec);
 }
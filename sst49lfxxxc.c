@@ -35,6 +35,7 @@
 
 #include "flash.h"
 #include "jedec.h"
+#include "writeplan.h"
 #include "debug.h"
 
 #define SECTOR_ERASE		0x30
@@ -50,30 +51,22 @@
 #define	STATUS_ESS		(1 << 6)
 #define	STATUS_WSMS		(1 << 7)
 
-static __inline__ int write_lockbits_49lfxxxc(volatile uint8_t *bios, int size,
-					      unsigned char bits)
+/* Each erase block has its lock register at offset 2 of the block */
+static int write_lockbits_49lfxxxc(struct flashchip *flash,
+				   unsigned char bits)
 {
-	int i, left = size;
-	unsigned long address;
+	volatile uint8_t *registers = flash->virtual_registers;
+	struct erase_block *blocks;
+	int i, n;
 
-	//printf("bios=0x%08lx\n", (unsigned long)bios);
-	for (i = 0; left > 65536; i++, left -= 65536) {
-		//printf("lockbits at address=0x%08lx is 0x%01x\n", (unsigned long)0xFFC00000 - size + (i * 65536) + 2, *(bios + (i * 65536) + 2) );
-		*(bios + (i * 65536) + 2) = bits;
-	}
-	address = i * 65536;
-	//printf("lockbits at address=0x%08lx is 0x%01x\n", (unsigned long)0xFFc00000 - size + address + 2, *(bios + address + 2) );
-	*(bios + address + 2) = bits;
-	address += 32768;
-	//printf("lockbits at address=0x%08lx is 0x%01x\n", (unsigned long)0xFFc00000 - size + address + 2, *(bios + address + 2) );
-	*(bios + address + 2) = bits;
-	address += 8192;
-	//printf("lockbits at address=0x%08lx is 0x%01x\n", (unsigned long)0xFFc00000 - size + address + 2, *(bios + address + 2) );
-	*(bios + address + 2) = bits;
-	address += 8192;
-	//printf("lockbits at address=0x%08lx is 0x%01x\n", (unsigned long)0xFFc00000 - size + address + 2, *(bios + address + 2) );
-	*(bios + address + 2) = bits;
+	n = flash_erase_blocks(flash, BLOCK_ERASE, &blocks);
+	if (n < 0)
+		return -1;
 
+	for (i = 0; i < n; i++)
+		chip_writeb(bits, registers + blocks[i].offset + 2);
+
+	free(blocks);
 	return (0);
 }
 
@@ -82,52 +75,70 @@ static __inline__ int erase_sector_49lfxxxc(volatile uint8_t *bios,
 {
 	unsigned char status;
 
-	*bios = SECTOR_ERASE;
-	*(bios + address) = ERASE;
+	chip_writeb(SECTOR_ERASE, bios);
+	chip_writeb(ERASE, bios + address);
 
 	do {
-		status = *bios;
+		status = chip_readb(bios);
 		if (status & (STATUS_ESS | STATUS_BPS)) {
 			printf("sector erase FAILED at address=0x%08lx status=0x%01x\n", (unsigned long)bios + address, status);
-			*bios = CLEAR_STATUS;
+			chip_writeb(CLEAR_STATUS, bios);
 			return (-1);
 		}
 	} while (!(status & STATUS_WSMS));
 
+	/* back to read array mode for the blank check */
+	chip_writeb(RESET, bios);
 	return (0);
 }
 
-static __inline__ int write_sector_49lfxxxc(volatile uint8_t *bios,
-					    uint8_t *src,
-					    volatile uint8_t *dst,
-					    unsigned int page_size)
+/*
+ * Program a sector without leaving status mode between bytes: the next
+ * AUTO PROGRAM follows as soon as WSMS reports ready, the sticky error
+ * bits are checked once at the end, and only then does the chip go back
+ * to read array mode. The bytes that already match are found in old,
+ * the write engine's copy of the sector.
+ */
+static int write_sector_49lfxxxc(struct flashchip *flash, uint8_t *src,
+				 const uint8_t *old, unsigned int offset,
+				 unsigned int size)
 {
-	int i;
+	volatile uint8_t *bios = flash->virtual_memory;
+	volatile uint8_t *dst = bios + offset;
+	unsigned int i;
+	int programmed = 0, ret = 0;
 	unsigned char status;
 
-	*bios = CLEAR_STATUS;
-	for (i = 0; i < page_size; i++) {
-		/* transfer data from source to destination */
-		if (*src == 0xFF) {
-			dst++, src++;
-			/* If the data is 0xFF, don't program it */
+	chip_writeb(CLEAR_STATUS, bios);
+	for (i = 0; i < size; i++) {
+		/* Skip bytes that already match */
+		if (old[i] == src[i])
 			continue;
-		}
 		/*issue AUTO PROGRAM command */
-		*bios = AUTO_PGRM;
-		*dst++ = *src++;
-
-		do {
-			status = *bios;
-			if (status & (STATUS_ESS | STATUS_BPS)) {
-				printf("sector write FAILED at address=0x%08lx status=0x%01x\n", (unsigned long)dst, status);
-				*bios = CLEAR_STATUS;
-				return (-1);
-			}
-		} while (!(status & STATUS_WSMS));
+		chip_writeb(AUTO_PGRM, bios);
+		chip_writeb(src[i], dst + i);
+		programmed = 1;
+
+		if (data_polling_jedec(flash, bios, STATUS_WSMS,
+				       FLASH_OP_PROGRAM)) {
+			ret = -1;
+			goto out;
+		}
 	}
 
-	return (0);
+	if (programmed) {
+		status = chip_readb(bios);
+		if (status & (STATUS_ESS | STATUS_BPS)) {
+			printf("sector write FAILED at address=0x%08x "
+			       "status=0x%01x\n", offset, status);
+			ret = -1;
+		}
+	}
+
+out:
+	chip_writeb(CLEAR_STATUS, bios);
+	chip_writeb(RESET, bios);
+	return ret;
 }
 
 int probe_49lfxxxc(struct flashchip *flash)
@@ -136,13 +147,17 @@ int probe_49lfxxxc(struct flashchip *flash)
 
 	uint8_t id1, id2;
 
-	*bios = RESET;
+	if (!probe_id_cached(probe_49lfxxxc, bios, &id1, &id2)) {
+		chip_writeb(RESET, bios);
+
+		chip_writeb(READ_ID, bios);
+		id1 = chip_readb(bios);
+		id2 = chip_readb(bios + 0x01);
 
-	*bios = READ_ID;
-	id1 = *(volatile uint8_t *)bios;
-	id2 = *(volatile uint8_t *)(bios + 0x01);
+		chip_writeb(RESET, bios);
 
-	*bios = RESET;
+		probe_id_store(probe_49lfxxxc, bios, id1, id2);
+	}
 
 	printf_debug("%s: id1 0x%x, id2 0x%x\n", __FUNCTION__, id1, id2);
 
@@ -157,40 +172,42 @@ int probe_49lfxxxc(struct flashchip *flash)
 int erase_49lfxxxc(struct flashchip *flash)
 {
 	volatile uint8_t *bios = flash->virtual_memory;
-	volatile uint8_t *registers = flash->virtual_registers;
 	int i;
 	unsigned int total_size = flash->total_size * 1024;
 
-	write_lockbits_49lfxxxc(registers, total_size, 0);
+	if (write_lockbits_49lfxxxc(flash, 0))
+		return (-1);
 	for (i = 0; i < total_size; i += flash->page_size)
 		if (erase_sector_49lfxxxc(bios, i) != 0)
 			return (-1);
 
-	*bios = RESET;
+	chip_writeb(RESET, bios);
 	return (0);
 }
 
+static int erase_block_49lfxxxc(struct flashchip *flash, unsigned int offset,
+				unsigned int size)
+{
+	return erase_sector_49lfxxxc(flash->virtual_memory, offset);
+}
+
+static int program_block_49lfxxxc(struct flashchip *flash, uint8_t *src,
+				  const uint8_t *old, unsigned int offset,
+				  unsigned int size)
+{
+	return write_sector_49lfxxxc(flash, src, old, offset, size);
+}
+
 int write_49lfxxxc(struct flashchip *flash, uint8_t *buf)
 {
-	int i;
-	int total_size = flash->total_size * 1024;
-	int page_size = flash->page_size;
+	int ret;
 	volatile uint8_t *bios = flash->virtual_memory;
 
-	write_lockbits_49lfxxxc(flash->virtual_registers, total_size, 0);
-	printf("Programming Page: ");
-	for (i = 0; i < total_size / page_size; i++) {
-		/* erase the page before programming */
-		erase_sector_49lfxxxc(bios, i * page_size);
-
-		/* write to the sector */
-		printf("%04d at address: 0x%08x", i, i * page_size);
-		write_sector_49lfxxxc(bios, buf + i * page_size,
-				      bios + i * page_size, page_size);
-		printf("\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
-	}
-	printf("\n");
+	if (write_lockbits_49lfxxxc(flash, 0))
+		return -1;
+	ret = write_flash_geometry(flash, buf, SECTOR_ERASE,
+				   erase_block_49lfxxxc, program_block_49lfxxxc);
 
-	*bios = RESET;
-	return (0);
+	chip_writeb(RESET, bios);
+	return ret;
 }
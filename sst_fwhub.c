@@ -25,6 +25,7 @@
 #include "flash.h"
 #include "jedec.h"
 #include "sst_fwhub.h"
+#include "writeplan.h"
 
 // I need that Berkeley bit-map printer
 void print_sst_fwhub_status(uint8_t status)
@@ -49,17 +50,15 @@ int probe_sst_fwhub(struct flashchip *flash)
 	return 1;
 }
 
-int erase_sst_fwhub_block(struct flashchip *flash, int offset)
+int erase_sst_fwhub_block(struct flashchip *flash, unsigned int offset,
+			  unsigned int size)
 {
 	volatile uint8_t *wrprotect = flash->virtual_registers + offset + 2;
 
 	// clear write protect
-	*(wrprotect) = 0;
+	chip_writeb(0, wrprotect);
 
-	erase_block_jedec(flash->virtual_memory, offset);
-	toggle_ready_jedec(flash->virtual_memory);
-
-	return (0);
+	return erase_block_jedec(flash, offset);
 }
 
 int erase_sst_fwhub(struct flashchip *flash)
@@ -68,35 +67,12 @@ int erase_sst_fwhub(struct flashchip *flash)
 	unsigned int total_size = flash->total_size * 1024;
 
 	for (i = 0; i < total_size; i += flash->page_size)
-		erase_sst_fwhub_block(flash, i);
+		erase_sst_fwhub_block(flash, i, flash->page_size);
 	return (0);
 }
 
 int write_sst_fwhub(struct flashchip *flash, uint8_t *buf)
 {
-	int i;
-	int total_size = flash->total_size * 1024;
-	int page_size = flash->page_size;
-	volatile uint8_t *bios = flash->virtual_memory;
-
-	// FIXME: We want block wide erase instead of ironing the whole chip
-	erase_sst_fwhub(flash);
-
-	// dumb check if erase was successful.
-	for (i = 0; i < total_size; i++) {
-		if (bios[i] != 0xff) {
-			printf("ERASE FAILED\n");
-			return -1;
-		}
-	}
-
-	printf("Programming Page: ");
-	for (i = 0; i < total_size / page_size; i++) {
-		printf("%04d at address: 0x%08x", i, i * page_size);
-		write_sector_jedec(bios, buf + i * page_size,
-				   bios + i * page_size, page_size);
-		printf("\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
-	}
-	printf("\n");
-	return (0);
+	return write_flash_blocks(flash, buf, flash->page_size,
+				  erase_sst_fwhub_block, program_block_jedec);
 }
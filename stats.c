@@ -0,0 +1,66 @@
+/*
+ * stats.c: bus and delay counters reported by --stats
+ *
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "stats.h"
+
+#ifndef DISABLE_STATS
+
+struct flash_stats flash_stats;
+
+void print_stats(int json)
+{
+	struct flash_stats *s = &flash_stats;
+
+	if (json) {
+		printf("{\"chip_reads\": %lu, \"chip_writes\": %lu, "
+		       "\"delays\": %lu, \"delay_usec\": %.0f, "
+		       "\"port_reads\": %lu, \"port_writes\": %lu, "
+		       "\"pci_reads\": %lu, \"pci_writes\": %lu}\n",
+		       s->chip_reads, s->chip_writes, s->delays,
+		       (double)s->delay_usec, s->port_reads, s->port_writes,
+		       s->pci_reads, s->pci_writes);
+		return;
+	}
+
+	printf("Statistics:\n");
+	printf("  flash window:  %lu reads, %lu writes\n",
+	       s->chip_reads, s->chip_writes);
+	printf("  delays:        %lu calls, %.0f us\n",
+	       s->delays, (double)s->delay_usec);
+	printf("  port I/O:      %lu reads, %lu writes\n",
+	       s->port_reads, s->port_writes);
+	printf("  PCI config:    %lu reads, %lu writes\n",
+	       s->pci_reads, s->pci_writes);
+}
+
+#else
+
+void print_stats(int json)
+{
+	if (json)
+		printf("{}\n");
+	else
+		printf("Statistics were disabled at build time.\n");
+}
+
+#endif				/* !DISABLE_STATS */
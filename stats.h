@@ -0,0 +1,48 @@
+#ifndef __STATS_H__
+#define __STATS_H__ 1
+
+#include <stdint.h>
+
+/*
+ * Bus and delay counters for --stats. Building with -DDISABLE_STATS
+ * turns every STAT_*() into nothing, so the polling loops stay as
+ * tight as they were.
+ */
+#ifndef DISABLE_STATS
+
+struct flash_stats {
+	unsigned long chip_reads, chip_writes;	/* flash window bytes */
+	unsigned long delays;			/* myusec_delay() calls */
+	uint64_t delay_usec;			/* ... and the time asked for */
+	unsigned long port_reads, port_writes;	/* inb/outb family */
+	unsigned long pci_reads, pci_writes;	/* PCI config space */
+};
+
+extern struct flash_stats flash_stats;
+
+#define STAT_INC(field)		(flash_stats.field++)
+#define STAT_ADD(field, n)	(flash_stats.field += (n))
+
+/* Count the config space accesses of files that include libpci first */
+#ifdef _PCI_LIB_H
+#define pci_read_byte(d, pos)	(STAT_INC(pci_reads), pci_read_byte(d, pos))
+#define pci_read_word(d, pos)	(STAT_INC(pci_reads), pci_read_word(d, pos))
+#define pci_read_long(d, pos)	(STAT_INC(pci_reads), pci_read_long(d, pos))
+#define pci_write_byte(d, pos, v) \
+	(STAT_INC(pci_writes), pci_write_byte(d, pos, v))
+#define pci_write_word(d, pos, v) \
+	(STAT_INC(pci_writes), pci_write_word(d, pos, v))
+#define pci_write_long(d, pos, v) \
+	(STAT_INC(pci_writes), pci_write_long(d, pos, v))
+#endif
+
+#else
+
+#define STAT_INC(field)		do { } while (0)
+#define STAT_ADD(field, n)	do { } while (0)
+
+#endif				/* !DISABLE_STATS */
+
+void print_stats(int json);
+
+#endif				/* !__STATS_H__ */
@@ -0,0 +1,207 @@
+/*
+ * trace.c: record flash window and port I/O cycles
+ *
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *
+ * With --trace every chip access and port I/O cycle is stored in a ring
+ * buffer allocated up front, so recording costs a clock read and a
+ * 16 byte store. Once the ring is full the oldest records are dropped.
+ * The ring is written out at exit, see trace.h for the file format.
+ * Virtual addresses are turned back into physical ones through the
+ * mappings registered by flashrom.c.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "flash.h"
+#include "udelay.h"
+#include "sim.h"
+#include "trace.h"
+
+#define TRACE_MAX_MAPPINGS	8
+
+struct trace_mapping {
+	const volatile uint8_t *virt;
+	uint64_t phys;
+	unsigned long len;
+};
+
+int trace_active = 0;
+
+static struct trace_record *ring;
+static unsigned long ring_size, ring_next, ring_count;
+static uint64_t trace_start;
+static char *trace_file;
+static char trace_chip_name[32];
+static struct trace_mapping trace_mappings[TRACE_MAX_MAPPINGS];
+
+/* The simulator has its own clock; real runs use the wall clock */
+static uint64_t trace_now(void)
+{
+	if (sim_active)
+		return sim_clock_ns() / 1000;
+	return myusec_now();
+}
+
+static void put_record(int kind, uint32_t address, uint32_t value,
+		       int width)
+{
+	struct trace_record *r = &ring[ring_next];
+	uint64_t now = trace_now();
+
+	/* time starts at the first cycle, on whichever clock is in use */
+	if (ring_count == 0)
+		trace_start = now;
+
+	r->usec = (uint32_t)(now - trace_start);
+	r->address = address;
+	r->value = value;
+	r->kind = kind;
+	r->width = width;
+	r->reserved = 0;
+
+	if (++ring_next == ring_size)
+		ring_next = 0;
+	ring_count++;
+}
+
+void trace_chip(int kind, const volatile void *addr, uint32_t value)
+{
+	const volatile uint8_t *p = (const volatile uint8_t *)addr;
+	uint32_t address = (uint32_t)(unsigned long)p;
+	int i;
+
+	for (i = 0; i < TRACE_MAX_MAPPINGS; i++) {
+		if (trace_mappings[i].virt == NULL ||
+		    p < trace_mappings[i].virt ||
+		    p >= trace_mappings[i].virt + trace_mappings[i].len)
+			continue;
+		address = (uint32_t)(trace_mappings[i].phys +
+				     (p - trace_mappings[i].virt));
+		break;
+	}
+
+	put_record(kind, address, value, 1);
+}
+
+void trace_port(int kind, unsigned short port, uint32_t value, int width)
+{
+	put_record(kind, port, value, width);
+}
+
+void trace_map(const volatile void *virt, uint64_t phys, unsigned long len)
+{
+	int i;
+
+	for (i = 0; i < TRACE_MAX_MAPPINGS; i++) {
+		if (trace_mappings[i].virt != NULL)
+			continue;
+		trace_mappings[i].virt = (const volatile uint8_t *)virt;
+		trace_mappings[i].phys = phys;
+		trace_mappings[i].len = len;
+		return;
+	}
+}
+
+void trace_unmap(const volatile void *virt)
+{
+	int i;
+
+	for (i = 0; i < TRACE_MAX_MAPPINGS; i++)
+		if (trace_mappings[i].virt == virt)
+			trace_mappings[i].virt = NULL;
+}
+
+void trace_set_chip(const char *name)
+{
+	strncpy(trace_chip_name, name, sizeof(trace_chip_name) - 1);
+}
+
+static void trace_flush(void)
+{
+	struct trace_header header;
+	unsigned long records, first;
+	FILE *f;
+
+	trace_active = 0;
+
+	records = ring_count < ring_size ? ring_count : ring_size;
+	first = ring_count < ring_size ? 0 : ring_next;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.version = TRACE_VERSION;
+	header.record_size = sizeof(struct trace_record);
+	header.records = records;
+	header.lost = ring_count - records;
+	memcpy(header.chip, trace_chip_name, sizeof(header.chip));
+
+	if ((f = fopen(trace_file, "wb")) == NULL) {
+		perror(trace_file);
+		return;
+	}
+	/* the ring holds the oldest records from first to its end */
+	if (fwrite(&header, sizeof(header), 1, f) != 1 ||
+	    fwrite(ring + first, sizeof(*ring), records - first, f) !=
+	    records - first ||
+	    fwrite(ring, sizeof(*ring), first, f) != first)
+		perror(trace_file);
+	fclose(f);
+
+	fprintf(stderr, "Wrote %lu bus cycles to %s", records, trace_file);
+	if (header.lost)
+		fprintf(stderr, " (%lu older ones dropped)",
+			(unsigned long)header.lost);
+	fprintf(stderr, "\n");
+
+	free(ring);
+}
+
+/* spec is "file[,records]" */
+int trace_init(const char *spec)
+{
+	char *comma;
+
+	trace_file = strdup(spec);
+	ring_size = TRACE_DEFAULT_RECORDS;
+	if ((comma = strchr(trace_file, ',')) != NULL) {
+		*comma = '\0';
+		ring_size = strtoul(comma + 1, NULL, 0);
+		if (ring_size == 0) {
+			fprintf(stderr, "Error: bad trace size \"%s\"\n",
+				comma + 1);
+			return -1;
+		}
+	}
+
+	ring = (struct trace_record *) malloc(ring_size * sizeof(*ring));
+	if (ring == NULL) {
+		fprintf(stderr, "Error: Out of memory for %lu trace records\n",
+			ring_size);
+		return -1;
+	}
+	/* fault the pages in now rather than in the middle of a write */
+	memset(ring, 0, ring_size * sizeof(*ring));
+
+	trace_active = 1;
+	atexit(trace_flush);
+
+	return 0;
+}
@@ -0,0 +1,51 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__ 1
+
+#include <stdint.h>
+
+/*
+ * Bus cycle trace file, written by --trace and read back by the replay
+ * tool. All fields are little endian. The header is followed by
+ * "records" trace_records, oldest first.
+ */
+#define TRACE_MAGIC		"FLTRACE1"
+#define TRACE_VERSION		1
+
+struct trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t records;	/* in this file */
+	uint32_t lost;		/* overwritten when the ring wrapped */
+	char chip[32];		/* flash part that was probed, if any */
+};
+
+enum trace_kind {
+	TRACE_READ,		/* flash window byte read */
+	TRACE_WRITE,		/* flash window byte write */
+	TRACE_READN,		/* flash window bulk read, value = length */
+	TRACE_PORT_IN,		/* inb/inw/inl, address = port */
+	TRACE_PORT_OUT,		/* outb/outw/outl, address = port */
+};
+
+struct trace_record {
+	uint32_t usec;		/* since the trace started */
+	uint32_t address;	/* physical address or I/O port */
+	uint32_t value;
+	uint8_t kind;		/* enum trace_kind */
+	uint8_t width;		/* bytes, for port I/O */
+	uint16_t reserved;
+};
+
+#define TRACE_DEFAULT_RECORDS	(1024 * 1024)
+
+extern int trace_active;
+
+int trace_init(const char *spec);
+void trace_map(const volatile void *virt, uint64_t phys, unsigned long len);
+void trace_unmap(const volatile void *virt);
+void trace_set_chip(const char *name);
+void trace_chip(int kind, const volatile void *addr, uint32_t value);
+void trace_port(int kind, unsigned short port, uint32_t value, int width);
+
+#endif				/* !__TRACE_H__ */
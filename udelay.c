@@ -1,17 +1,64 @@
 #include <sys/time.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#ifdef __MINGW32_VERSION
+#include <windows.h>
+#endif
+#include "flash.h"
+#include "udelay.h"
+#include "sim.h"
 #include "debug.h"
 
+/*
+ * Delays are measured against a monotonic hardware clock: the performance
+ * counter on Windows, CLOCK_MONOTONIC_RAW (or CLOCK_MONOTONIC) elsewhere.
+ * Neither drifts with CPU frequency scaling, and neither needs a
+ * calibration pass at startup. Only when no such clock can be found do we
+ * fall back to a counted busy loop, calibrated on its first use.
+ *
+ * Waits of at least sleep_threshold microseconds give the CPU back: the
+ * bulk of the wait is slept and only the last stretch is spun, so a long
+ * erase does not keep a core busy. The sleep may overshoot, which only
+ * makes the delay longer, never shorter.
+ */
+
+/* Spin at least this long at the end of a sleeping wait */
+#ifdef __MINGW32_VERSION
+#define SPIN_MARGIN	2000	/* Sleep() works in milliseconds */
+#else
+#define SPIN_MARGIN	100
+#endif
+
+enum delay_clock {
+	DELAY_CLOCK_NONE = 0,	/* not probed yet */
+	DELAY_CLOCK_QPC,
+	DELAY_CLOCK_POSIX,
+	DELAY_CLOCK_LOOP,
+};
+
+static int delay_clock = DELAY_CLOCK_NONE;
+#ifdef __MINGW32_VERSION
+static uint64_t qpc_freq;
+#endif
+#if defined(CLOCK_MONOTONIC_RAW)
+static clockid_t posix_clock = CLOCK_MONOTONIC_RAW;
+#elif defined(CLOCK_MONOTONIC)
+static clockid_t posix_clock = CLOCK_MONOTONIC;
+#endif
+
 // count to a billion. Time it. If it's < 1 sec, count to 10B, etc.
 unsigned long micro = 1;
+static int micro_calibrated = 0;
+static int sleep_threshold = DEFAULT_SLEEP_THRESHOLD;
 
-void myusec_delay(int time)
+static void loop_delay(int time)
 {
 	volatile unsigned long i;
 	for (i = 0; i < time * micro; i++) ;
 }
 
-void myusec_calibrate_delay()
+static void calibrate_loop(void)
 {
 	int count = 1000;
 	unsigned long timeusec;
@@ -22,7 +69,7 @@ void myusec_calibrate_delay()
 
 	while (!ok) {
 		gettimeofday(&start, 0);
-		myusec_delay(count);
+		loop_delay(count);
 		gettimeofday(&end, 0);
 		timeusec = 1000000 * (end.tv_sec - start.tv_sec) +
 		    (end.tv_usec - start.tv_usec);
@@ -34,7 +81,157 @@ void myusec_calibrate_delay()
 
 	// compute one microsecond. That will be count / time
 	micro = count / timeusec;
+	micro_calibrated = 1;
 
 	printf_debug("%ldM loops per second. ", (unsigned long)micro);
 	printf("ok\n");
 }
+
+/* Current time in microseconds on the selected clock */
+static uint64_t clock_usec(void)
+{
+#ifdef __MINGW32_VERSION
+	if (delay_clock == DELAY_CLOCK_QPC) {
+		LARGE_INTEGER now;
+
+		QueryPerformanceCounter(&now);
+		return (uint64_t)now.QuadPart / qpc_freq * 1000000 +
+		    (uint64_t)now.QuadPart % qpc_freq * 1000000 / qpc_freq;
+	}
+#endif
+#if defined(CLOCK_MONOTONIC_RAW) || defined(CLOCK_MONOTONIC)
+	if (delay_clock == DELAY_CLOCK_POSIX) {
+		struct timespec now;
+
+		clock_gettime(posix_clock, &now);
+		return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+	}
+#endif
+	return 0;
+}
+
+static void select_delay_clock(void)
+{
+#ifdef __MINGW32_VERSION
+	LARGE_INTEGER freq;
+
+	/* The counter is invariant on every system that reports one */
+	if (QueryPerformanceFrequency(&freq) && freq.QuadPart > 0) {
+		qpc_freq = freq.QuadPart;
+		delay_clock = DELAY_CLOCK_QPC;
+		printf_debug("Using the performance counter for delays "
+			     "(%lu Hz).\n", (unsigned long)qpc_freq);
+		return;
+	}
+#endif
+#if defined(CLOCK_MONOTONIC_RAW) || defined(CLOCK_MONOTONIC)
+	{
+		struct timespec res;
+
+		if (clock_getres(posix_clock, &res) == 0 &&
+		    res.tv_sec == 0 && res.tv_nsec <= 1000) {
+			delay_clock = DELAY_CLOCK_POSIX;
+			printf_debug("Using the monotonic clock for delays.\n");
+			return;
+		}
+#if defined(CLOCK_MONOTONIC_RAW) && defined(CLOCK_MONOTONIC)
+		posix_clock = CLOCK_MONOTONIC;
+		if (clock_getres(posix_clock, &res) == 0 &&
+		    res.tv_sec == 0 && res.tv_nsec <= 1000) {
+			delay_clock = DELAY_CLOCK_POSIX;
+			printf_debug("Using the monotonic clock for delays.\n");
+			return;
+		}
+#endif
+	}
+#endif
+	delay_clock = DELAY_CLOCK_LOOP;
+}
+
+/* Give up the CPU for roughly usec microseconds, never less */
+static void sleep_usec(unsigned long usec)
+{
+#ifdef __MINGW32_VERSION
+	Sleep(usec / 1000);
+#else
+	struct timespec req, rem;
+
+	req.tv_sec = usec / 1000000;
+	req.tv_nsec = (usec % 1000000) * 1000;
+	while (nanosleep(&req, &rem) != 0)
+		req = rem;
+#endif
+}
+
+/* Wall clock in microseconds, for timing whole operations */
+uint64_t myusec_now(void)
+{
+	struct timeval tv;
+
+	if (delay_clock == DELAY_CLOCK_NONE)
+		select_delay_clock();
+	if (delay_clock != DELAY_CLOCK_LOOP)
+		return clock_usec();
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void myusec_set_sleep_threshold(int usec)
+{
+	sleep_threshold = usec;
+}
+
+void myusec_delay(int time)
+{
+	uint64_t now, end;
+
+	if (time <= 0)
+		return;
+
+	STAT_INC(delays);
+	STAT_ADD(delay_usec, time);
+
+	/* the simulated chip runs on its own clock */
+	if (sim_active) {
+		sim_delay(time);
+		return;
+	}
+
+	if (delay_clock == DELAY_CLOCK_NONE)
+		select_delay_clock();
+
+	if (delay_clock == DELAY_CLOCK_LOOP) {
+		if (!micro_calibrated)
+			calibrate_loop();
+		if (sleep_threshold > 0 && time >= sleep_threshold &&
+		    time > SPIN_MARGIN) {
+			/* No clock to check against, so trust the sleep */
+			sleep_usec(time - SPIN_MARGIN);
+			time = SPIN_MARGIN;
+		}
+		loop_delay(time);
+		return;
+	}
+
+	now = clock_usec();
+	end = now + time;
+	if (sleep_threshold > 0 && time >= sleep_threshold) {
+		while (now + SPIN_MARGIN < end) {
+			sleep_usec(end - now - SPIN_MARGIN);
+			now = clock_usec();
+		}
+	}
+	while (clock_usec() < end) ;
+}
+
+/*
+ * Kept for the startup path: this only picks a clock, which costs a
+ * system call or two. The busy loop is calibrated later, and only if
+ * there is no usable clock.
+ */
+void myusec_calibrate_delay()
+{
+	if (delay_clock == DELAY_CLOCK_NONE)
+		select_delay_clock();
+}
@@ -1,6 +1,13 @@
 #ifndef __UDELAY_H__
 #define __UDELAY_H__
 
+#include <stdint.h>
+
+/* Waits this long (in microseconds) or longer sleep instead of spinning */
+#define DEFAULT_SLEEP_THRESHOLD	1000
+
 void myusec_delay(int time);
+void myusec_set_sleep_threshold(int usec);
+uint64_t myusec_now(void);
 
 #endif
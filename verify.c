@@ -0,0 +1,463 @@
+/*
+ * verify.c: compare the flash contents against an image
+ *
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *
+ * The chip is copied into a bounce buffer in large chunks, so the flash
+ * window sees long runs of sequential reads instead of one volatile byte
+ * access per compare, and the buffer is then compared against the image
+ * 32 (AVX2), 16 (SSE2) or sizeof(long) bytes at a time. The kernels are
+ * picked at run time from what the CPU supports, so a build for plain
+ * i386 still uses the vector units where they exist. Every mismatching
+ * run is recorded, so one pass yields the complete list of bad ranges.
+ * The same wide reads back the blank check used around erases.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "flash.h"
+#include "verify.h"
+#include "writeplan.h"
+#include "debug.h"
+
+/* gcc 4.9 and later can build per-function SSE2/AVX2 code on x86 */
+#if (defined(__i386__) || defined(__x86_64__)) && defined(__GNUC__) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define VERIFY_SIMD 1
+#include <immintrin.h>
+#endif
+
+#define VERIFY_CHUNK	(64 * 1024)
+
+struct compare_kernels {
+	unsigned int (*first_mismatch) (const uint8_t *a, const uint8_t *b,
+					unsigned int len);
+	unsigned int (*first_match) (const uint8_t *a, const uint8_t *b,
+				     unsigned int len);
+	unsigned int (*first_non_blank) (const uint8_t *p, unsigned int len);
+};
+
+static unsigned int mismatch_long(const uint8_t *a, const uint8_t *b,
+				  unsigned int len)
+{
+	unsigned int i;
+
+	for (i = 0; i + sizeof(unsigned long) <= len;
+	     i += sizeof(unsigned long)) {
+		unsigned long x, y;
+
+		memcpy(&x, a + i, sizeof(x));
+		memcpy(&y, b + i, sizeof(y));
+		if (x != y)
+			break;
+	}
+	for (; i < len; i++)
+		if (a[i] != b[i])
+			return i;
+
+	return len;
+}
+
+static unsigned int match_byte(const uint8_t *a, const uint8_t *b,
+			       unsigned int len)
+{
+	unsigned int i;
+
+	for (i = 0; i < len; i++)
+		if (a[i] == b[i])
+			return i;
+
+	return len;
+}
+
+static unsigned int non_blank_long(const uint8_t *p, unsigned int len)
+{
+	unsigned int i;
+
+	for (i = 0; i + sizeof(unsigned long) <= len;
+	     i += sizeof(unsigned long)) {
+		unsigned long x;
+
+		memcpy(&x, p + i, sizeof(x));
+		if (x != ~0UL)
+			break;
+	}
+	for (; i < len; i++)
+		if (p[i] != 0xff)
+			return i;
+
+	return len;
+}
+
+#ifdef VERIFY_SIMD
+__attribute__ ((target("sse2")))
+static unsigned int mismatch_sse2(const uint8_t *a, const uint8_t *b,
+				  unsigned int len)
+{
+	unsigned int i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+		unsigned int eq = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+
+		if (eq != 0xffff)
+			return i + __builtin_ctz(~eq);
+	}
+
+	return i + mismatch_long(a + i, b + i, len - i);
+}
+
+__attribute__ ((target("sse2")))
+static unsigned int match_sse2(const uint8_t *a, const uint8_t *b,
+			       unsigned int len)
+{
+	unsigned int i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+		unsigned int eq = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+
+		if (eq != 0)
+			return i + __builtin_ctz(eq);
+	}
+
+	return i + match_byte(a + i, b + i, len - i);
+}
+
+__attribute__ ((target("sse2")))
+static unsigned int non_blank_sse2(const uint8_t *p, unsigned int len)
+{
+	__m128i ff = _mm_set1_epi8(-1);
+	unsigned int i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(p + i));
+		unsigned int eq = _mm_movemask_epi8(_mm_cmpeq_epi8(x, ff));
+
+		if (eq != 0xffff)
+			return i + __builtin_ctz(~eq);
+	}
+
+	return i + non_blank_long(p + i, len - i);
+}
+
+__attribute__ ((target("avx2")))
+static unsigned int mismatch_avx2(const uint8_t *a, const uint8_t *b,
+				  unsigned int len)
+{
+	unsigned int i;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+		__m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+		uint32_t eq = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+
+		if (eq != 0xffffffff)
+			return i + __builtin_ctz(~eq);
+	}
+
+	return i + mismatch_long(a + i, b + i, len - i);
+}
+
+__attribute__ ((target("avx2")))
+static unsigned int match_avx2(const uint8_t *a, const uint8_t *b,
+			       unsigned int len)
+{
+	unsigned int i;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+		__m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+		uint32_t eq = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+
+		if (eq != 0)
+			return i + __builtin_ctz(eq);
+	}
+
+	return i + match_byte(a + i, b + i, len - i);
+}
+
+__attribute__ ((target("avx2")))
+static unsigned int non_blank_avx2(const uint8_t *p, unsigned int len)
+{
+	__m256i ff = _mm256_set1_epi8(-1);
+	unsigned int i;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(p + i));
+		uint32_t eq = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, ff));
+
+		if (eq != 0xffffffff)
+			return i + __builtin_ctz(~eq);
+	}
+
+	return i + non_blank_long(p + i, len - i);
+}
+#endif				/* VERIFY_SIMD */
+
+static const struct compare_kernels *select_kernels(void)
+{
+	static const struct compare_kernels generic = {
+		mismatch_long, match_byte, non_blank_long
+	};
+#ifdef VERIFY_SIMD
+	static const struct compare_kernels sse2 = {
+		mismatch_sse2, match_sse2, non_blank_sse2
+	};
+	static const struct compare_kernels avx2 = {
+		mismatch_avx2, match_avx2, non_blank_avx2
+	};
+
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return &avx2;
+	if (__builtin_cpu_supports("sse2"))
+		return &sse2;
+#endif
+	return &generic;
+}
+
+static const struct compare_kernels *kernels;
+
+/* Index of the first byte where a and b differ, or len */
+unsigned int first_mismatch(const uint8_t *a, const uint8_t *b,
+			    unsigned int len)
+{
+	if (kernels == NULL)
+		kernels = select_kernels();
+	return kernels->first_mismatch(a, b, len);
+}
+
+/* Index of the first byte where a and b agree, or len */
+unsigned int first_match(const uint8_t *a, const uint8_t *b,
+			 unsigned int len)
+{
+	if (kernels == NULL)
+		kernels = select_kernels();
+	return kernels->first_match(a, b, len);
+}
+
+/* Index of the first byte that is not 0xff (erased), or len */
+unsigned int first_non_blank(const uint8_t *p, unsigned int len)
+{
+	if (kernels == NULL)
+		kernels = select_kernels();
+	return kernels->first_non_blank(p, len);
+}
+
+/*
+ * Copy len bytes starting at start out of the chip. Chips with their own
+ * read method (DiskOnChip) can only be read as a whole.
+ */
+int read_flash_range(struct flashchip *flash, uint8_t *dst,
+		     unsigned int start, unsigned int len)
+{
+	uint8_t *tmp;
+
+	if (flash->read == NULL) {
+		chip_readn(dst, flash->virtual_memory + start, len);
+		return 0;
+	}
+
+	tmp = (uint8_t *) malloc(flash->total_size * 1024);
+	if (tmp == NULL) {
+		fprintf(stderr, "Error: Out of memory for the read buffer\n");
+		return -1;
+	}
+	flash->read(flash, tmp);
+	memcpy(dst, tmp + start, len);
+	free(tmp);
+
+	return 0;
+}
+
+/*
+ * The command with the smallest erase blocks in the chip's erase table,
+ * the unit a mismatch is reported in; 0 if the chip has no table.
+ */
+static uint8_t finest_erase_opcode(struct flashchip *flash)
+{
+	const struct erase_region *r, *best = NULL;
+
+	if (flash->erase_regions == NULL)
+		return 0;
+	for (r = flash->erase_regions; r->block_size; r++)
+		if (best == NULL || r->block_size < best->block_size)
+			best = r;
+
+	return best ? best->opcode : 0;
+}
+
+static int add_range(struct flashchip *flash, struct flash_range **ranges,
+		     int *nranges, int *alloc, unsigned int start,
+		     unsigned int len, uint8_t opcode)
+{
+	struct erase_block b;
+	struct flash_range *r;
+
+	/* A run continuing across a chunk boundary extends the last range */
+	if (*nranges > 0) {
+		r = &(*ranges)[*nranges - 1];
+		if (r->start + r->len == start) {
+			r->len += len;
+			return 0;
+		}
+	}
+
+	if (*nranges == *alloc) {
+		*alloc = *alloc ? *alloc * 2 : 16;
+		r = (struct flash_range *) realloc(*ranges,
+						   *alloc * sizeof(*r));
+		if (r == NULL) {
+			fprintf(stderr, "Error: Out of memory for the "
+				"mismatch list\n");
+			return -1;
+		}
+		*ranges = r;
+	}
+
+	r = &(*ranges)[(*nranges)++];
+	r->start = start;
+	r->len = len;
+	r->block_start = 0;
+	r->block_size = 0;
+	if (opcode && find_erase_block(flash, opcode, start, &b) == 0) {
+		r->block_start = b.offset;
+		r->block_size = b.size;
+	}
+
+	return 0;
+}
+
+/*
+ * Compare the whole chip against buf. Returns the number of mismatching
+ * ranges and hands back the malloc'ed list in *ranges (NULL when the
+ * contents match), or -1 on error.
+ */
+int compare_flash(struct flashchip *flash, uint8_t *buf,
+		  struct flash_range **ranges)
+{
+	unsigned int total_size = flash->total_size * 1024;
+	unsigned int chunk = VERIFY_CHUNK;
+	unsigned int offset, len, i, n;
+	int nranges = 0, alloc = 0;
+	uint8_t opcode = finest_erase_opcode(flash);
+	uint8_t *bounce;
+
+	*ranges = NULL;
+
+	if (flash->read != NULL)
+		chunk = total_size;
+	if (chunk > total_size)
+		chunk = total_size;
+
+	bounce = (uint8_t *) malloc(chunk);
+	if (bounce == NULL) {
+		fprintf(stderr, "Error: Out of memory for the verify buffer\n");
+		return -1;
+	}
+
+	for (offset = 0; offset < total_size; offset += len) {
+		len = total_size - offset;
+		if (len > chunk)
+			len = chunk;
+
+		if (read_flash_range(flash, bounce, offset, len))
+			goto fail;
+
+		for (i = 0; i < len; i += n) {
+			i += first_mismatch(bounce + i, buf + offset + i,
+					    len - i);
+			if (i == len)
+				break;
+			n = first_match(bounce + i, buf + offset + i, len - i);
+			if (add_range(flash, ranges, &nranges, &alloc,
+				      offset + i, n, opcode))
+				goto fail;
+		}
+	}
+
+	free(bounce);
+	return nranges;
+
+fail:
+	free(bounce);
+	free(*ranges);
+	*ranges = NULL;
+	return -1;
+}
+
+/*
+ * Blank check the erase blocks of block_size bytes covering
+ * [start, start + len). Every block that is not fully erased is counted
+ * and, if failed is not NULL, flagged in failed[] (indexed by block
+ * number within the chip). Returns the number of such blocks, or -1.
+ */
+int blank_check(struct flashchip *flash, unsigned int start,
+		unsigned int len, unsigned int block_size, uint8_t *failed)
+{
+	unsigned int offset, n, chunk = VERIFY_CHUNK;
+	int nfailed = 0;
+	uint8_t *bounce;
+
+	if (chunk > len)
+		chunk = len;
+	if (chunk < block_size && block_size <= len)
+		chunk = block_size;
+
+	bounce = (uint8_t *) malloc(chunk);
+	if (bounce == NULL) {
+		fprintf(stderr, "Error: Out of memory for the blank check\n");
+		return -1;
+	}
+
+	for (offset = start; offset < start + len; offset += n) {
+		/* never let a read straddle an erase block */
+		n = block_size - offset % block_size;
+		if (n > start + len - offset)
+			n = start + len - offset;
+		if (n > chunk)
+			n = chunk;
+
+		if (read_flash_range(flash, bounce, offset, n)) {
+			nfailed = -1;
+			break;
+		}
+		if (first_non_blank(bounce, n) == n)
+			continue;
+
+		printf_debug("%s: block %d at 0x%08x is not blank\n",
+			     __FUNCTION__, offset / block_size,
+			     offset - offset % block_size);
+		nfailed++;
+		if (failed != NULL)
+			failed[offset / block_size] = 1;
+
+		/* skip the rest of this block */
+		n = block_size - offset % block_size;
+		if (n > start + len - offset)
+			n = start + len - offset;
+	}
+
+	free(bounce);
+	return nfailed;
+}
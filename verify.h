@@ -0,0 +1,27 @@
+#ifndef __VERIFY_H__
+#define __VERIFY_H__ 1
+
+/* A run of bytes where the chip and the image disagree */
+struct flash_range {
+	unsigned int start;
+	unsigned int len;
+	/* the smallest erase block holding start; block_size is 0 if
+	 * the chip has no erase table */
+	unsigned int block_start;
+	unsigned int block_size;
+};
+
+extern unsigned int first_mismatch(const uint8_t *a, const uint8_t *b,
+				   unsigned int len);
+extern unsigned int first_match(const uint8_t *a, const uint8_t *b,
+				unsigned int len);
+extern unsigned int first_non_blank(const uint8_t *p, unsigned int len);
+extern int read_flash_range(struct flashchip *flash, uint8_t *dst,
+			    unsigned int start, unsigned int len);
+extern int compare_flash(struct flashchip *flash, uint8_t *buf,
+			 struct flash_range **ranges);
+extern int blank_check(struct flashchip *flash, unsigned int start,
+		       unsigned int len, unsigned int block_size,
+		       uint8_t *failed);
+
+#endif				/* !__VERIFY_H__ */
@@ -25,7 +25,9 @@
 #include "flash.h"
 #include "jedec.h"
 #include "w39v040fa.h"
+#include "writeplan.h"
 #include "direct_io.h"
+#include "sim.h"
 
 enum {
 	BLOCKING_REGS_PHY_RANGE = 0x80000,
@@ -33,26 +35,30 @@ enum {
 };
 
 
-static volatile char * unprotect_39v040fa(void)
+static volatile uint8_t * unprotect_39v040fa(void)
 {
 	unsigned char i, byte_val;
-	volatile char * block_regs_base;
+	volatile uint8_t * block_regs_base;
 
-	block_regs_base = (volatile char*) map_physical_addr_range( BLOCKING_REGS_PHY_BASE, BLOCKING_REGS_PHY_RANGE);
+	if (sim_active)
+		block_regs_base = sim_map(BLOCKING_REGS_PHY_BASE, BLOCKING_REGS_PHY_RANGE);
+	else
+		block_regs_base = (volatile uint8_t *) map_physical_addr_range( BLOCKING_REGS_PHY_BASE, BLOCKING_REGS_PHY_RANGE);
 	if (block_regs_base == NULL) {
 		perror("Error: Unable to map Winbond w39v040fa blocking registers!\n");
 		return NULL;
 	}
+	trace_map(block_regs_base, BLOCKING_REGS_PHY_BASE, BLOCKING_REGS_PHY_RANGE);
 
 	// 
 	// Unprotect the BIOS chip address range
 	//
 	for( i = 0; i < 8 ; i++ )
 	{
-		byte_val =  *(block_regs_base + 2 + i*0x10000);
+		byte_val = chip_readb(block_regs_base + 2 + i*0x10000);
 		myusec_delay(10);
 		byte_val &= 0xF8; // Enable full access to the chip
-		*(block_regs_base + 2 + i*0x10000) = byte_val;
+		chip_writeb(byte_val, block_regs_base + 2 + i*0x10000);
 		myusec_delay(10);
 	}
 
@@ -60,53 +66,52 @@ static volatile char * unprotect_39v040fa(void)
 }
 
 
-static void protect_39v040fa(volatile char * reg_base)
+static void protect_39v040fa(volatile uint8_t * reg_base)
 {
 	//
 	// Protect the BIOS chip address range
 	//
 	unsigned char i, byte_val;
-	volatile char * block_regs_base = reg_base;
+	volatile uint8_t * block_regs_base = reg_base;
 
 	for( i = 0; i < 8 ; i++ )
 	{
-		byte_val = *(block_regs_base + 2 + i*0x10000);
+		byte_val = chip_readb(block_regs_base + 2 + i*0x10000);
 		myusec_delay(10);
 		byte_val |= 1; // Prohibited to write in the block where set
-		*(block_regs_base + 2 + i*0x10000) = byte_val;
+		chip_writeb(byte_val, block_regs_base + 2 + i*0x10000);
 		myusec_delay(10);
 	}
 
-	unmap_physical_addr_range((void*) reg_base, BLOCKING_REGS_PHY_RANGE);
+	trace_unmap(reg_base);
+	if (sim_active)
+		sim_unmap(reg_base);
+	else
+		unmap_physical_addr_range((void*) reg_base, BLOCKING_REGS_PHY_RANGE);
 }
 
 
+static int erase_block_39v040fa(struct flashchip *flash, unsigned int offset,
+				unsigned int size)
+{
+	return erase_block_jedec(flash, offset);
+}
+
 int write_39v040fa(struct flashchip *flash, uint8_t *buf)
 {
-	int i;
-	int total_size = flash->total_size * 1024;
-	int page_size = flash->page_size;
-	volatile uint8_t *bios = flash->virtual_memory;
-	volatile char * reg_base;
+	volatile uint8_t * reg_base;
+	int ret;
 	
 	reg_base = unprotect_39v040fa();
-	erase_chip_jedec(flash);
-
-	printf("Programming Page: ");
-	for (i = 0; i < total_size / page_size; i++) {
-		/* write to the sector */
-		printf("%04d at address: 0x%08x", i, i * page_size);
-		write_sector_jedec(bios, buf + i * page_size,
-				   bios + i * page_size, page_size);
-		printf("\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
-		fflush(stdout);
-	}
-	printf("\n");
+
+	/* 64K block erase, so only the blocks that change are erased */
+	ret = write_flash_blocks(flash, buf, flash->page_size,
+				 erase_block_39v040fa, program_block_jedec);
 
 	if(NULL != reg_base)
 	{
 	    protect_39v040fa(reg_base);
 	}
 	
-	return (0);
+	return ret;
 }
@@ -30,26 +30,10 @@
 #include "flash.h"
 #include "jedec.h"
 #include "w49f002u.h"
+#include "writeplan.h"
 
 int write_49f002(struct flashchip *flash, uint8_t *buf)
 {
-	int i;
-	int total_size = flash->total_size * 1024;
-	int page_size = flash->page_size;
-	volatile uint8_t *bios = flash->virtual_memory;
-
-	erase_chip_jedec(flash);
-
-	printf("Programming Page: ");
-	for (i = 0; i < total_size / page_size; i++) {
-		/* write to the sector */
-		printf("%04d at address: 0x%08x ", i, i * page_size);
-		write_sector_jedec(bios, buf + i * page_size,
-				   bios + i * page_size, page_size);
-		printf("\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
-		fflush(stdout);
-	}
-	printf("\n");
-
-	return (0);
+	return write_flash_blocks(flash, buf, flash->page_size, NULL,
+				  program_block_jedec);
 }
@@ -0,0 +1,887 @@
+/*
+ * writeplan.c: block-level differential write engine
+ *
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *
+ * The engine reads the current chip contents once through
+ * flash->virtual_memory (or flash->read), compares them against the new
+ * image one erase block at a time and sorts every block into one of
+ * three plans:
+ *
+ *  - identical:    nothing to do
+ *  - program only: the new data only clears bits (old & new == new),
+ *                  so it can be programmed on top of the old contents
+ *  - erase:        at least one bit has to go from 0 to 1
+ *
+ * Only erase blocks are handed to the driver's erase helper. The program
+ * helpers skip bytes that already hold the wanted value, so a program
+ * only block costs one program cycle per changed byte.
+ *
+ * Drivers that can only erase the whole chip pass a NULL erase_block;
+ * if any block needs an erase the chip is erased with flash->erase and
+ * every block that is not blank in the new image is reprogrammed.
+ *
+ * Blocks that are already blank on the chip never need an erase, since
+ * any data can be programmed on top of them. After an erase the affected
+ * blocks are blank checked, and only the blocks that failed the check
+ * are erased again (the whole chip for chip-erase-only drivers).
+ *
+ * The program helpers get the block as the chip holds it: the snapshot
+ * taken for the plan, or all 0xff once the block has been erased.
+ *
+ * flash->write_mask marks the pages (page_size units) that may change;
+ * -s/-e and the ROM layout clear the bits of the pages they keep.
+ * Blocks without a writable page are neither read nor compared nor
+ * written. Blocks that are only partly masked go through the normal
+ * plan; the caller has already merged the chip contents into the kept
+ * bytes of the image, so such a block becomes a read-modify-write. Only
+ * a chip-erase-only driver that needs an erase still touches masked
+ * blocks, restoring them from the image afterwards.
+ *
+ * write_flash_blocks() works on uniform blocks; write_flash_geometry()
+ * takes the blocks of one erase command from the chip's erase_regions
+ * table, so boot block parts are diffed and erased block by block too.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "flash.h"
+#include "jedec.h"
+#include "writeplan.h"
+#include "verify.h"
+#include "debug.h"
+
+#define MAX_ERASE_TRIES	3
+
+/* Progress is redrawn at most this often; terminals are slow */
+#define PROGRESS_USEC	250000
+
+enum block_plan {
+	BLOCK_IDENTICAL = 0,
+	BLOCK_PROGRAM,
+	BLOCK_ERASE,
+	BLOCK_MASKED,
+};
+
+static int page_writable(struct flashchip *flash, unsigned int page)
+{
+	return flash->write_mask == NULL ||
+	    (flash->write_mask[page / 8] & (1 << (page % 8)));
+}
+
+/*
+ * Clear the write mask bits of every page lying entirely inside
+ * [start, end]. The mask is allocated, all pages writable, on first use
+ * and lives as long as the program. Returns the number of pages masked,
+ * or -1 if out of memory.
+ */
+int write_mask_exclude(struct flashchip *flash, unsigned int start,
+		       unsigned int end)
+{
+	unsigned int total_size = flash->total_size * 1024;
+	unsigned int npages = total_size / flash->page_size;
+	unsigned int page, first, last;
+	int n = 0;
+
+	if (flash->write_mask == NULL) {
+		flash->write_mask = (uint8_t *) malloc((npages + 7) / 8);
+		if (flash->write_mask == NULL) {
+			fprintf(stderr, "Error: Out of memory for the "
+				"write mask\n");
+			return -1;
+		}
+		memset(flash->write_mask, 0xff, (npages + 7) / 8);
+	}
+
+	if (end >= total_size)
+		end = total_size - 1;
+	if (start > end)
+		return 0;
+
+	first = (start + flash->page_size - 1) / flash->page_size;
+	last = (end + 1) / flash->page_size;
+	for (page = first; page < last; page++) {
+		if (page_writable(flash, page))
+			n++;
+		flash->write_mask[page / 8] &= ~(1 << (page % 8));
+	}
+
+	return n;
+}
+
+/* May anything in [offset, offset + size) be changed? */
+int block_writable(struct flashchip *flash, unsigned int offset,
+		   unsigned int size)
+{
+	unsigned int page, last;
+
+	if (flash->write_mask == NULL)
+		return 1;
+
+	last = (offset + size - 1) / flash->page_size;
+	for (page = offset / flash->page_size; page <= last; page++)
+		if (page_writable(flash, page))
+			return 1;
+
+	return 0;
+}
+
+static int classify_block(uint8_t *old, uint8_t *new, unsigned int size)
+{
+	unsigned int i;
+	int plan = BLOCK_IDENTICAL;
+
+	for (i = 0; i < size; i++) {
+		if (old[i] == new[i])
+			continue;
+		if ((old[i] & new[i]) != new[i])
+			return BLOCK_ERASE;
+		plan = BLOCK_PROGRAM;
+	}
+
+	return plan;
+}
+
+/* Number of blocks in region r, filling in a count of 0 */
+static unsigned int region_blocks(struct flashchip *flash,
+				  const struct erase_region *r)
+{
+	const struct erase_region *o;
+	unsigned int rest = flash->total_size * 1024;
+
+	if (r->count)
+		return r->count;
+
+	for (o = flash->erase_regions; o->block_size; o++)
+		if (o->opcode == r->opcode && o->count)
+			rest -= o->block_size * o->count;
+
+	return rest / r->block_size;
+}
+
+/*
+ * List the erase blocks of the given erase command, bottom up, in a
+ * malloc'd array. In an erase_regions table a count of 0 stands for as
+ * many blocks as the other regions of the command leave room for. Chips
+ * without regions for the command get uniform page_size blocks with a
+ * NULL region. Returns the number of blocks, or -1 on error.
+ */
+int flash_erase_blocks(struct flashchip *flash, uint8_t opcode,
+		       struct erase_block **blocks)
+{
+	unsigned int total_size = flash->total_size * 1024;
+	const struct erase_region *r;
+	unsigned int i, n = 0, offset = 0;
+	struct erase_block *b;
+
+	if (flash->erase_regions != NULL)
+		for (r = flash->erase_regions; r->block_size; r++)
+			if (r->opcode == opcode)
+				n += region_blocks(flash, r);
+	if (n == 0)
+		n = total_size / flash->page_size;
+
+	b = (struct erase_block *) malloc(n * sizeof(*b));
+	if (b == NULL) {
+		fprintf(stderr, "Error: Out of memory for the erase blocks\n");
+		return -1;
+	}
+
+	n = 0;
+	if (flash->erase_regions != NULL) {
+		for (r = flash->erase_regions; r->block_size; r++) {
+			if (r->opcode != opcode)
+				continue;
+			for (i = region_blocks(flash, r); i > 0; i--) {
+				b[n].offset = offset;
+				b[n].size = r->block_size;
+				b[n].region = r;
+				offset += r->block_size;
+				n++;
+			}
+		}
+	}
+	if (n == 0) {
+		for (; offset < total_size; offset += flash->page_size) {
+			b[n].offset = offset;
+			b[n].size = flash->page_size;
+			b[n].region = NULL;
+			n++;
+		}
+	}
+
+	if (offset != total_size) {
+		fprintf(stderr, "Error: the erase blocks of %s for command "
+			"0x%02x cover %d of %d KB\n", flash->name, opcode,
+			offset / 1024, total_size / 1024);
+		free(b);
+		return -1;
+	}
+
+	*blocks = b;
+	return n;
+}
+
+/*
+ * Find the erase block of the given command that holds offset.
+ * Returns 0, or -1 if the chip's table does not describe the command.
+ */
+int find_erase_block(struct flashchip *flash, uint8_t opcode,
+		     unsigned int offset, struct erase_block *block)
+{
+	const struct erase_region *r;
+	unsigned int start = 0, size;
+
+	if (flash->erase_regions == NULL)
+		return -1;
+
+	for (r = flash->erase_regions; r->block_size; r++) {
+		if (r->opcode != opcode)
+			continue;
+		size = r->block_size * region_blocks(flash, r);
+		if (offset < start + size) {
+			block->offset = offset - (offset - start) % r->block_size;
+			block->size = r->block_size;
+			block->region = r;
+			return 0;
+		}
+		start += size;
+	}
+
+	return -1;
+}
+
+static int erase_chip_checked(struct flashchip *flash,
+			      struct erase_block *blocks, unsigned int n,
+			      uint8_t *failed, uint8_t *old)
+{
+	unsigned int i;
+	int tries, nfailed = 0;
+
+	for (tries = 0; tries < MAX_ERASE_TRIES; tries++) {
+		if (flash->erase(flash)) {
+			printf("ERASE FAILED: chip erase did not complete\n");
+			return -1;
+		}
+		for (i = 0, nfailed = 0; i < n; i++) {
+			failed[i] = blank_check(flash, blocks[i].offset,
+						blocks[i].size, blocks[i].size,
+						NULL) != 0;
+			nfailed += failed[i];
+		}
+		if (nfailed == 0) {
+			memset(old, 0xff, flash->total_size * 1024);
+			return 0;
+		}
+	}
+
+	printf("ERASE FAILED in %d blocks:", nfailed);
+	for (i = 0; i < n; i++)
+		if (failed[i])
+			printf(" %d", i);
+	printf("\n");
+
+	return -1;
+}
+
+static int erase_block_checked(struct flashchip *flash, unsigned int block,
+			       struct erase_block *b, uint8_t *old,
+			       int (*erase_block) (struct flashchip *flash,
+						   unsigned int offset,
+						   unsigned int size))
+{
+	int tries;
+
+	for (tries = 0; tries < MAX_ERASE_TRIES; tries++) {
+		if (erase_block(flash, b->offset, b->size))
+			break;
+		if (blank_check(flash, b->offset, b->size, b->size,
+				NULL) == 0) {
+			memset(old + b->offset, 0xff, b->size);
+			return 0;
+		}
+	}
+
+	printf("ERASE FAILED in block %d at address: 0x%08x\n", block,
+	       b->offset);
+	return -1;
+}
+
+static uint64_t progress_time;
+static int progress_shown;
+
+static void start_progress(void)
+{
+	printf("Programming Page: ");
+	progress_shown = 0;
+}
+
+static void show_progress(unsigned int block, unsigned int offset)
+{
+	uint64_t now = myusec_now();
+
+	if (progress_shown && now - progress_time < PROGRESS_USEC)
+		return;
+	if (progress_shown)
+		printf("\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
+	printf("%04d at address: 0x%08x", block, offset);
+	fflush(stdout);
+	progress_shown = 1;
+	progress_time = now;
+}
+
+static int program_one_block(struct flashchip *flash, uint8_t *buf,
+			     uint8_t *old, unsigned int block,
+			     struct erase_block *b,
+			     int (*program_block) (struct flashchip *flash,
+						   uint8_t *src,
+						   const uint8_t *old,
+						   unsigned int offset,
+						   unsigned int size))
+{
+	show_progress(block, b->offset);
+	return program_block(flash, buf + b->offset, old + b->offset,
+			     b->offset, b->size);
+}
+
+/*
+ * Read the blocks that may change into old (the whole chip if none is
+ * masked) and sort every block into a plan. Returns the number of
+ * masked blocks.
+ */
+static unsigned int plan_block_list(struct flashchip *flash, uint8_t *buf,
+				    struct erase_block *blocks,
+				    unsigned int nblocks, uint8_t *old,
+				    uint8_t *plan)
+{
+	unsigned int total_size = flash->total_size * 1024;
+	unsigned int i, masked = 0;
+	struct erase_block *b;
+
+	for (i = 0; i < nblocks; i++) {
+		plan[i] = BLOCK_IDENTICAL;
+		if (!block_writable(flash, blocks[i].offset, blocks[i].size)) {
+			plan[i] = BLOCK_MASKED;
+			masked++;
+		}
+	}
+
+	/* Snapshot the chip once instead of re-reading it per block */
+	if (flash->read != NULL)
+		flash->read(flash, old);
+	else if (masked == 0)
+		chip_readn(old, flash->virtual_memory, total_size);
+	else
+		for (i = 0, b = blocks; i < nblocks; i++, b++)
+			if (plan[i] != BLOCK_MASKED)
+				chip_readn(old + b->offset,
+					   flash->virtual_memory + b->offset,
+					   b->size);
+
+	for (i = 0, b = blocks; i < nblocks; i++, b++) {
+		if (plan[i] == BLOCK_MASKED)
+			continue;
+		plan[i] = classify_block(old + b->offset, buf + b->offset,
+					 b->size);
+		/* a page write erases the page on its own */
+		if (plan[i] == BLOCK_ERASE &&
+		    (flash->feature_bits & FEATURE_PAGE_WRITE))
+			plan[i] = BLOCK_PROGRAM;
+	}
+
+	return masked;
+}
+
+static int write_block_list(struct flashchip *flash, uint8_t *buf,
+			    struct erase_block *blocks, unsigned int nblocks,
+			    int (*erase_block) (struct flashchip *flash,
+						unsigned int offset,
+						unsigned int size),
+			    int (*program_block) (struct flashchip *flash,
+						  uint8_t *src,
+						  const uint8_t *old,
+						  unsigned int offset,
+						  unsigned int size))
+{
+	unsigned int total_size = flash->total_size * 1024;
+	unsigned int i, changed = 0, erased = 0, programmed = 0;
+	unsigned int masked = 0;
+	int chip_erased = 0;
+	uint8_t *old, *plan;
+	struct erase_block *b;
+	int ret = 0;
+
+	old = (uint8_t *) malloc(total_size);
+	plan = (uint8_t *) calloc(nblocks, sizeof(uint8_t));
+	if (old == NULL || plan == NULL) {
+		fprintf(stderr, "Error: Out of memory for the write plan\n");
+		free(old);
+		free(plan);
+		return -1;
+	}
+
+	masked = plan_block_list(flash, buf, blocks, nblocks, old, plan);
+	for (i = 0; i < nblocks; i++) {
+		if (plan[i] == BLOCK_PROGRAM || plan[i] == BLOCK_ERASE)
+			changed++;
+		if (plan[i] == BLOCK_ERASE)
+			erased++;
+	}
+
+	printf_debug("%s: %d of %d blocks differ, %d need an erase, "
+		     "%d masked\n", __FUNCTION__, changed, nblocks, erased,
+		     masked);
+
+	if (changed == 0) {
+		printf("Flash contents already match the image, "
+		       "nothing to write.\n");
+		goto out;
+	}
+
+	if (erase_block == NULL && erased != 0) {
+		/* Whole-chip erase: everything not blank must come back,
+		 * masked blocks included */
+		if (masked)
+			printf("This chip can only be erased as a whole, "
+			       "restoring %d masked blocks.\n", masked);
+		chip_erased = 1;
+		if (erase_chip_checked(flash, blocks, nblocks, plan, old)) {
+			ret = -1;
+			goto out;
+		}
+		for (i = 0, b = blocks; i < nblocks; i++, b++) {
+			if (first_non_blank(buf + b->offset, b->size) ==
+			    b->size)
+				plan[i] = BLOCK_IDENTICAL;
+			else
+				plan[i] = BLOCK_PROGRAM;
+		}
+	}
+
+	start_progress();
+	for (i = 0, b = blocks; i < nblocks; i++, b++) {
+		if (plan[i] == BLOCK_IDENTICAL || plan[i] == BLOCK_MASKED)
+			continue;
+
+		if (plan[i] == BLOCK_ERASE &&
+		    erase_block_checked(flash, i, b, old, erase_block)) {
+			ret = -1;
+			goto out;
+		}
+
+		if (program_one_block(flash, buf, old, i, b, program_block))
+			ret = -1;
+		programmed++;
+	}
+	printf("\n");
+
+	if (chip_erased)
+		printf("%d of %d blocks differed, chip erased, "
+		       "%d blocks written.\n", changed, nblocks, programmed);
+	else
+		printf("%d of %d blocks differed, %d erased, "
+		       "%d programmed without an erase.\n", changed, nblocks,
+		       erased, programmed - erased);
+
+out:
+	free(old);
+	free(plan);
+	return ret;
+}
+
+int write_flash_blocks(struct flashchip *flash, uint8_t *buf,
+		       unsigned int block_size,
+		       int (*erase_block) (struct flashchip *flash,
+					   unsigned int offset,
+					   unsigned int size),
+		       int (*program_block) (struct flashchip *flash,
+					     uint8_t *src, const uint8_t *old,
+					     unsigned int offset,
+					     unsigned int size))
+{
+	unsigned int nblocks = flash->total_size * 1024 / block_size;
+	struct erase_block *blocks;
+	unsigned int i;
+	int ret;
+
+	blocks = (struct erase_block *) malloc(nblocks * sizeof(*blocks));
+	if (blocks == NULL) {
+		fprintf(stderr, "Error: Out of memory for the write plan\n");
+		return -1;
+	}
+	for (i = 0; i < nblocks; i++) {
+		blocks[i].offset = i * block_size;
+		blocks[i].size = block_size;
+		blocks[i].region = NULL;
+	}
+
+	ret = write_block_list(flash, buf, blocks, nblocks, erase_block,
+			       program_block);
+	free(blocks);
+
+	return ret;
+}
+
+/* Like write_flash_blocks(), on the blocks of the given erase command */
+int write_flash_geometry(struct flashchip *flash, uint8_t *buf,
+			 uint8_t opcode,
+			 int (*erase_block) (struct flashchip *flash,
+					     unsigned int offset,
+					     unsigned int size),
+			 int (*program_block) (struct flashchip *flash,
+					       uint8_t *src,
+					       const uint8_t *old,
+					       unsigned int offset,
+					       unsigned int size))
+{
+	struct erase_block *blocks;
+	int n, ret;
+
+	n = flash_erase_blocks(flash, opcode, &blocks);
+	if (n < 0)
+		return -1;
+
+	ret = write_block_list(flash, buf, blocks, n, erase_block,
+			       program_block);
+	free(blocks);
+
+	return ret;
+}
+
+/*
+ * Erase planner for chips with more than one erase size. The plan
+ * starts at the finest erase block: each one is either programmed in
+ * place, if it only clears bits, or erased and programmed. Going up one
+ * erase size at a time, a larger block is erased as a whole when that,
+ * plus programming everything non-blank inside it, is estimated cheaper
+ * than the best plan for its parts. A chip erase is weighed last. The
+ * estimates come from the typical times in the chip's timing table.
+ *
+ * Sparse changes thus stay at the smallest erase size, while dense ones
+ * collapse into block or chip erases. Masked blocks are never erased,
+ * so no larger erase is chosen across them.
+ */
+
+#define MAX_ERASE_METHODS	4
+#define COST_INFINITE		((uint64_t)1 << 62)
+
+struct erase_level {
+	struct erase_block *blocks;
+	unsigned int n;
+	uint64_t *best;		/* cheapest plan for each block, in us */
+	uint64_t *blank;	/* cost to program it once it is erased */
+	uint8_t *erase;		/* erase the block as a whole? */
+	unsigned int *parent;	/* the enclosing block one level up */
+	const struct erase_method *method;
+};
+
+static const char *erase_op_names[] = {
+	"program", "sector", "block", "chip"
+};
+
+/* Saturating sum, so a forbidden choice stays forbidden */
+static uint64_t cost_add(uint64_t a, uint64_t b)
+{
+	if (a >= COST_INFINITE || b >= COST_INFINITE)
+		return COST_INFINITE;
+	return a + b;
+}
+
+static uint64_t op_usec(struct flashchip *flash, enum flash_op op)
+{
+	unsigned long typ, max;
+
+	flash_op_timing(flash, op, &typ, &max);
+	return typ ? typ : max;
+}
+
+static enum flash_op level_op(struct erase_level *l, unsigned int i)
+{
+	if (l->blocks[i].region == NULL)
+		return FLASH_OP_SECTOR_ERASE;
+	return l->blocks[i].region->op;
+}
+
+static void free_level(struct erase_level *l)
+{
+	free(l->blocks);
+	free(l->best);
+	free(l->blank);
+	free(l->erase);
+	free(l->parent);
+}
+
+static int alloc_level(struct erase_level *l)
+{
+	l->best = (uint64_t *) calloc(l->n, sizeof(uint64_t));
+	l->blank = (uint64_t *) calloc(l->n, sizeof(uint64_t));
+	l->erase = (uint8_t *) calloc(l->n, sizeof(uint8_t));
+	l->parent = (unsigned int *) calloc(l->n, sizeof(unsigned int));
+	if (l->best == NULL || l->blank == NULL || l->erase == NULL ||
+	    l->parent == NULL) {
+		fprintf(stderr, "Error: Out of memory for the erase plan\n");
+		return -1;
+	}
+	return 0;
+}
+
+/* Costs for the finest erase blocks, from the diff against the chip */
+static void plan_fine_level(struct flashchip *flash, struct erase_level *l,
+			    uint8_t *old, uint8_t *buf, uint8_t *plan)
+{
+	uint64_t program = op_usec(flash, FLASH_OP_PROGRAM);
+	uint64_t keep, erase;
+	unsigned int i, j, nonblank, diff;
+	struct erase_block *b;
+
+	for (i = 0, b = l->blocks; i < l->n; i++, b++) {
+		nonblank = diff = 0;
+		for (j = b->offset; j < b->offset + b->size; j++) {
+			if (buf[j] != 0xff)
+				nonblank++;
+			if (plan[i] != BLOCK_MASKED && old[j] != buf[j])
+				diff++;
+		}
+
+		if (plan[i] == BLOCK_MASKED)
+			l->blank[i] = COST_INFINITE;
+		else
+			l->blank[i] = nonblank * program;
+
+		if (plan[i] == BLOCK_ERASE)
+			keep = COST_INFINITE;
+		else if (plan[i] == BLOCK_PROGRAM)
+			keep = diff * program;
+		else
+			keep = 0;
+
+		erase = cost_add(op_usec(flash, level_op(l, i)), l->blank[i]);
+		l->erase[i] = erase < keep;
+		l->best[i] = l->erase[i] ? erase : keep;
+	}
+}
+
+/*
+ * Costs for the blocks of a larger erase, built from the level below.
+ * Fails if the smaller blocks do not nest inside the larger ones.
+ */
+static int plan_coarse_level(struct flashchip *flash, struct erase_level *l,
+			     struct erase_level *below)
+{
+	unsigned int i, j = 0;
+	struct erase_block *b, *p;
+	uint64_t sum, erase;
+
+	for (i = 0, b = below->blocks; i < below->n; i++, b++) {
+		while (j < l->n && l->blocks[j].offset + l->blocks[j].size <=
+		       b->offset)
+			j++;
+		p = &l->blocks[j];
+		if (j == l->n || b->offset < p->offset ||
+		    b->offset + b->size > p->offset + p->size)
+			return -1;
+		below->parent[i] = j;
+	}
+
+	for (j = 0; j < l->n; j++) {
+		sum = 0;
+		l->blank[j] = 0;
+		for (i = 0; i < below->n; i++) {
+			if (below->parent[i] != j)
+				continue;
+			sum = cost_add(sum, below->best[i]);
+			l->blank[j] = cost_add(l->blank[j], below->blank[i]);
+		}
+		erase = cost_add(op_usec(flash, level_op(l, j)), l->blank[j]);
+		l->erase[j] = erase < sum;
+		l->best[j] = l->erase[j] ? erase : sum;
+	}
+
+	return 0;
+}
+
+/*
+ * Write buf using the cheapest mix of the given erase methods. methods
+ * are ordered from the smallest erase to the largest; each names an
+ * erase command from the chip's erase_regions table, and a last method
+ * with opcode 0 allows a chip erase through flash->erase.
+ */
+int write_flash_planned(struct flashchip *flash, uint8_t *buf,
+			const struct erase_method *methods, int nmethods,
+			int (*program_block) (struct flashchip *flash,
+					      uint8_t *src,
+					      const uint8_t *old,
+					      unsigned int offset,
+					      unsigned int size))
+{
+	struct erase_level levels[MAX_ERASE_METHODS];
+	unsigned int total_size = flash->total_size * 1024;
+	unsigned int i, j, changed = 0, programmed = 0;
+	unsigned int erases[MAX_ERASE_METHODS];
+	uint64_t chip_cost, top_cost = 0;
+	int k, n, nlevels = 0, top, chip_erase = 0, ret = 0;
+	struct erase_level *l, *fine = &levels[0];
+	uint8_t *old = NULL, *plan = NULL, *done = NULL;
+
+	if (nmethods < 1 || nmethods > MAX_ERASE_METHODS ||
+	    methods[0].opcode == 0) {
+		fprintf(stderr, "Error: %s: bad erase method list\n",
+			__FUNCTION__);
+		return -1;
+	}
+	memset(levels, 0, sizeof(levels));
+	memset(erases, 0, sizeof(erases));
+
+	/* Erase levels, skipping commands whose blocks do not nest */
+	for (k = 0; k < nmethods && methods[k].opcode != 0; k++) {
+		l = &levels[nlevels];
+		l->method = &methods[k];
+		n = flash_erase_blocks(flash, methods[k].opcode, &l->blocks);
+		if (n < 0) {
+			ret = -1;
+			goto out;
+		}
+		l->n = n;
+		if (nlevels > 0 && l->blocks[0].region == NULL) {
+			/* not in the chip's table, nothing to plan with */
+			free(l->blocks);
+			memset(l, 0, sizeof(*l));
+			continue;
+		}
+		if (alloc_level(l)) {
+			free_level(l);
+			ret = -1;
+			goto out;
+		}
+		nlevels++;
+	}
+
+	old = (uint8_t *) malloc(total_size);
+	plan = (uint8_t *) malloc(fine->n);
+	done = (uint8_t *) malloc(fine->n);
+	if (old == NULL || plan == NULL || done == NULL) {
+		fprintf(stderr, "Error: Out of memory for the write plan\n");
+		ret = -1;
+		goto out;
+	}
+
+	plan_block_list(flash, buf, fine->blocks, fine->n, old, plan);
+	for (i = 0; i < fine->n; i++)
+		if (plan[i] == BLOCK_PROGRAM || plan[i] == BLOCK_ERASE)
+			changed++;
+	if (changed == 0) {
+		printf("Flash contents already match the image, "
+		       "nothing to write.\n");
+		goto out;
+	}
+
+	plan_fine_level(flash, fine, old, buf, plan);
+	for (k = 1; k < nlevels; k++) {
+		if (plan_coarse_level(flash, &levels[k], &levels[k - 1])) {
+			printf_debug("%s: command 0x%02x blocks do not nest, "
+				     "not using them\n", __FUNCTION__,
+				     levels[k].method->opcode);
+			free_level(&levels[k]);
+			memmove(&levels[k], &levels[k + 1],
+				(nlevels - k - 1) * sizeof(levels[0]));
+			memset(&levels[--nlevels], 0, sizeof(levels[0]));
+			k--;
+		}
+	}
+	top = nlevels - 1;
+
+	/* The chip erase competes with the best plan for the top level */
+	chip_cost = COST_INFINITE;
+	for (j = 0; j < levels[top].n; j++)
+		top_cost = cost_add(top_cost, levels[top].best[j]);
+	if (methods[nmethods - 1].opcode == 0) {
+		chip_cost = op_usec(flash, FLASH_OP_CHIP_ERASE);
+		for (j = 0; j < levels[top].n; j++)
+			chip_cost = cost_add(chip_cost, levels[top].blank[j]);
+		chip_erase = chip_cost < top_cost;
+	}
+	printf_debug("%s: %d of %d blocks differ, plan takes about %lu ms%s\n",
+		     __FUNCTION__, changed, fine->n,
+		     (unsigned long)((chip_erase ? chip_cost : top_cost) / 1000),
+		     chip_erase ? " with a chip erase" : "");
+
+	if (chip_erase) {
+		if (erase_chip_checked(flash, fine->blocks, fine->n, done,
+				       old)) {
+			ret = -1;
+			goto out;
+		}
+		memset(done, 1, fine->n);
+	} else {
+		/* Erase top down; a block inside an erased one is done */
+		for (k = top; k >= 0; k--) {
+			l = &levels[k];
+			for (j = 0; j < l->n; j++) {
+				if (k < top && levels[k + 1].erase[l->parent[j]]) {
+					l->erase[j] = 1;
+					continue;
+				}
+				if (!l->erase[j])
+					continue;
+				if (erase_block_checked(flash, j, &l->blocks[j],
+							old, l->method->erase)) {
+					ret = -1;
+					goto out;
+				}
+				erases[k]++;
+			}
+		}
+		memcpy(done, fine->erase, fine->n);
+	}
+
+	start_progress();
+	for (i = 0; i < fine->n; i++) {
+		if (done[i]) {
+			if (first_non_blank(buf + fine->blocks[i].offset,
+					    fine->blocks[i].size) ==
+			    fine->blocks[i].size)
+				continue;
+		} else if (plan[i] != BLOCK_PROGRAM)
+			continue;
+
+		if (program_one_block(flash, buf, old, i, &fine->blocks[i],
+				      program_block))
+			ret = -1;
+		programmed++;
+	}
+	printf("\n");
+
+	printf("%d of %d blocks differed, ", changed, fine->n);
+	if (chip_erase)
+		printf("chip erased, ");
+	for (k = 0; k < nlevels; k++)
+		if (erases[k])
+			printf("%d %s erases, ", erases[k],
+			       erase_op_names[level_op(&levels[k], 0)]);
+	printf("%d blocks programmed.\n", programmed);
+
+out:
+	for (k = 0; k < nlevels; k++)
+		free_level(&levels[k]);
+	free(old);
+	free(plan);
+	free(done);
+	return ret;
+}
@@ -0,0 +1,56 @@
+#ifndef __WRITEPLAN_H__
+#define __WRITEPLAN_H__ 1
+
+/* One erase block; region is NULL for chips without a geometry table */
+struct erase_block {
+	unsigned int offset;
+	unsigned int size;
+	const struct erase_region *region;
+};
+
+/* One way to erase: a command from the erase_regions table and the
+ * driver's helper that issues it, or opcode 0 for flash->erase
+ */
+struct erase_method {
+	uint8_t opcode;
+	int (*erase) (struct flashchip *flash, unsigned int offset,
+		      unsigned int size);
+};
+
+extern int flash_erase_blocks(struct flashchip *flash, uint8_t opcode,
+			      struct erase_block **blocks);
+extern int find_erase_block(struct flashchip *flash, uint8_t opcode,
+			    unsigned int offset, struct erase_block *block);
+extern int write_mask_exclude(struct flashchip *flash, unsigned int start,
+			      unsigned int end);
+extern int block_writable(struct flashchip *flash, unsigned int offset,
+			  unsigned int size);
+extern int write_flash_blocks(struct flashchip *flash, uint8_t *buf,
+			      unsigned int block_size,
+			      int (*erase_block) (struct flashchip *flash,
+						  unsigned int offset,
+						  unsigned int size),
+			      int (*program_block) (struct flashchip *flash,
+						    uint8_t *src,
+						    const uint8_t *old,
+						    unsigned int offset,
+						    unsigned int size));
+extern int write_flash_geometry(struct flashchip *flash, uint8_t *buf,
+				uint8_t opcode,
+				int (*erase_block) (struct flashchip *flash,
+						    unsigned int offset,
+						    unsigned int size),
+				int (*program_block) (struct flashchip *flash,
+						      uint8_t *src,
+						      const uint8_t *old,
+						      unsigned int offset,
+						      unsigned int size));
+extern int write_flash_planned(struct flashchip *flash, uint8_t *buf,
+			       const struct erase_method *methods, int nmethods,
+			       int (*program_block) (struct flashchip *flash,
+						     uint8_t *src,
+						     const uint8_t *old,
+						     unsigned int offset,
+						     unsigned int size));
+
+#endif				/* !__WRITEPLAN_H__ */